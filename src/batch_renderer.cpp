@@ -0,0 +1,99 @@
+#include <exception>
+#include <mutex>
+#include <unordered_map>
+
+#include "batch_renderer.h"
+#include "io/ioutil.h"
+#include "io/mesh_cache.h"
+#include "io/scene_format.h"
+#include "phong_shader.h"
+#include "triangle_renderer.h"
+#include "wireframe_renderer.h"
+
+void render_software(const Scene& scene, Image& image, SoftwareRenderMode mode, ThreadPool& pool)
+{
+    if (mode == SoftwareRenderMode::Wireframe) {
+        WireframeRenderer renderer;
+        renderer.render(image, scene);
+    } else {
+        TriangleRenderer renderer(pool);
+        if (mode == SoftwareRenderMode::DeferredPhong) {
+            PhongShader shader(true);
+            renderer.render_deferred(&shader, image, scene);
+        } else {
+            PhongShader shader(mode == SoftwareRenderMode::Phong);
+            renderer.render(&shader, image, scene);
+        }
+    }
+}
+
+void render_job(const BatchJob& job, Scene scene, Image& image, ThreadPool& pool)
+{
+    if (job.camera_translation)
+        scene.camera().translation_matrix() = *job.camera_translation;
+    if (job.camera_rotation)
+        scene.camera().rotation_matrix() = *job.camera_rotation;
+    if (job.camera_projection)
+        scene.camera().projection_matrix() = *job.camera_projection;
+
+    render_software(scene, image, job.mode, pool);
+}
+
+size_t run_batch(const std::vector<BatchJob>& jobs, ThreadPool& pool, std::ostream& log)
+{
+    // Find the distinct scenes, keeping the order they first appear in
+    std::vector<std::string> scene_paths;
+    std::unordered_map<std::string, size_t> scene_indices;
+    std::vector<size_t> job_scenes;
+    for (const BatchJob& job : jobs) {
+        auto inserted = scene_indices.emplace(job.scene_path, scene_paths.size());
+        if (inserted.second)
+            scene_paths.push_back(job.scene_path);
+        job_scenes.push_back(inserted.first->second);
+    }
+
+    // Scenes share their meshes and instances between copies, so copying a loaded
+    // scene to change the camera for a job only copies the camera and the lights
+    MeshCache mesh_cache(0, &pool);
+    std::vector<Scene> scenes(scene_paths.size());
+    std::vector<std::exception_ptr> scene_errors(scene_paths.size());
+    std::vector<SceneReadReport> reports(scene_paths.size());
+    pool.parallel_for(scene_paths.size(), [&](size_t i) {
+        try {
+            const std::string& path = scene_paths[i];
+            scenes[i] = read_scene(str_from_file(path), directory_of(path), mesh_cache, &reports[i]);
+        } catch (...) {
+            scene_errors[i] = std::current_exception();
+        }
+    });
+
+    for (size_t i = 0; i < scene_paths.size(); i++) {
+        if (reports[i].unused_meshes.empty())
+            continue;
+        log << scene_paths[i] << ": meshes declared but not used:";
+        for (const std::string& identifier : reports[i].unused_meshes)
+            log << ' ' << identifier;
+        log << '\n';
+    }
+
+    std::mutex log_mutex;
+    size_t failed = 0;
+
+    pool.parallel_for(jobs.size(), [&](size_t i) {
+        const BatchJob& job = jobs[i];
+        try {
+            if (scene_errors[job_scenes[i]])
+                std::rethrow_exception(scene_errors[job_scenes[i]]);
+
+            Image image(job.width, job.height);
+            render_job(job, scenes[job_scenes[i]], image, pool);
+            write_image(image, job.format, job.output_path);
+        } catch (const std::exception& e) {
+            std::lock_guard<std::mutex> lock(log_mutex);
+            log << job.output_path << ": " << e.what() << '\n';
+            failed++;
+        }
+    });
+
+    return failed;
+}
\ No newline at end of file
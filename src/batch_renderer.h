@@ -0,0 +1,51 @@
+#pragma once
+
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "image.h"
+#include "io/image_format.h"
+#include "scene.h"
+#include "thread_pool.h"
+
+enum class SoftwareRenderMode
+{
+    Wireframe,
+    Gouraud,
+    Phong,
+    DeferredPhong
+};
+
+// Renders the scene into the image with one of the software renderers, spreading
+// the work over the pool
+void render_software(const Scene& scene, Image& image, SoftwareRenderMode mode, ThreadPool& pool);
+
+// One image to render in a batch
+struct BatchJob
+{
+    std::string scene_path;
+    int width, height;
+    SoftwareRenderMode mode;
+    // May be empty if the image is not written to a file
+    std::string output_path;
+    ImageFormat format;
+
+    // Replace the corresponding parts of the scene's camera if given
+    std::optional<Mat4> camera_translation;
+    std::optional<Mat4> camera_rotation;
+    std::optional<Mat4> camera_projection;
+};
+
+// Renders the job's view of the scene, which it was loaded from, into the image.
+// The image must have the job's size.
+void render_job(const BatchJob& job, Scene scene, Image& image, ThreadPool& pool);
+
+// Renders every job and writes the images to their output paths. Each scene file
+// is read once and each mesh file once across all scenes, however many jobs use
+// them. Jobs run concurrently on the pool, and each render also spreads its own
+// work over the pool. A job that fails does not stop the others; its error is
+// written to the log, as are meshes that scenes declare but do not use. Returns
+// the number of jobs that failed.
+size_t run_batch(const std::vector<BatchJob>& jobs, ThreadPool& pool, std::ostream& log);
\ No newline at end of file
@@ -40,11 +40,66 @@ struct Colour
     static unsigned char to_byte(float val);
 };
 
-Colour operator+(const Colour& c1, const Colour& c2);
-Colour operator-(const Colour& c1, const Colour& c2);
-Colour operator*(const Colour& c1, const Colour& c2);
-Colour operator*(const Colour& c, float v);
-Colour operator*(float v, const Colour& c);
-Colour operator/(const Colour& c, float v);
+// The arithmetic is inline since it is used per pixel by the software renderer
+
+inline Colour operator+(const Colour& c1, const Colour& c2)
+{
+    return Colour(c1.r + c2.r, c1.g + c2.g, c1.b + c2.b);
+}
+
+inline Colour operator-(const Colour& c1, const Colour& c2)
+{
+    return Colour(c1.r - c2.r, c1.g - c2.g, c1.b - c2.b);
+}
+
+inline Colour operator*(const Colour& c1, const Colour& c2)
+{
+    return Colour(c1.r * c2.r, c1.g * c2.g, c1.b * c2.b);
+}
+
+inline Colour operator*(const Colour& c, float v)
+{
+    return Colour(c.r * v, c.g * v, c.b * v);
+}
+
+inline Colour operator*(float v, const Colour& c)
+{
+    return c * v;
+}
+
+inline Colour operator/(const Colour& c, float v)
+{
+    return (1.0f / v) * c;
+}
+
+inline Colour& Colour::operator+=(const Colour& c)
+{
+    *this = *this + c;
+    return *this;
+}
+
+inline Colour& Colour::operator-=(const Colour& c)
+{
+    *this = *this - c;
+    return *this;
+}
+
+inline Colour& Colour::operator*=(const Colour& c)
+{
+    *this = *this * c;
+    return *this;
+}
+
+inline Colour& Colour::operator*=(float v)
+{
+    *this = *this * v;
+    return *this;
+}
+
+inline Colour& Colour::operator/=(float v)
+{
+    *this = *this / v;
+    return *this;
+}
 
 std::ostream& operator<<(std::ostream& out, const Colour& c);
\ No newline at end of file
@@ -0,0 +1,146 @@
+#include "conjugate_gradient.h"
+
+#include <array>
+
+using Sums = std::array<double, 3>;
+
+static Sums add_up(const std::vector<Sums>& partial_sums)
+{
+    Sums total = { 0.0, 0.0, 0.0 };
+    for (const Sums& sums : partial_sums)
+        for (int c = 0; c < 3; c++)
+            total[c] += sums[c];
+    return total;
+}
+
+bool solve_conjugate_gradient(const Eigen::SparseMatrix<float>& a,
+                              const RowVectors3& b,
+                              RowVectors3& x,
+                              float tolerance,
+                              int max_iterations,
+                              ThreadPool* pool)
+{
+    const size_t n = a.rows();
+    // Rows are processed in chunks, whose partial sums are added up in the same
+    // order no matter how many threads there are
+    const size_t chunk_count = parallel_chunk_count(n);
+
+    // Since A is symmetric, its columns can be read as rows
+    const int* starts = a.outerIndexPtr();
+    const int* indices = a.innerIndexPtr();
+    const float* values = a.valuePtr();
+
+    // Writes row i of A v to out
+    auto multiply_row = [&](const float* v, size_t i, float* out) {
+        float sum[3] = { 0.0f, 0.0f, 0.0f };
+        for (int k = starts[i]; k < starts[i + 1]; k++) {
+            const float* row = v + 3 * (size_t)indices[k];
+            for (int c = 0; c < 3; c++)
+                sum[c] += values[k] * row[c];
+        }
+        for (int c = 0; c < 3; c++)
+            out[c] = sum[c];
+    };
+
+    std::vector<float> inverse_diagonal(n);
+    for (size_t i = 0; i < n; i++)
+        inverse_diagonal[i] = 1.0f / a.coeff(i, i);
+
+    // The vectors of the method, as rows of three
+    std::vector<float> residual(3 * n), preconditioned(3 * n), direction(3 * n), product(3 * n);
+    float* r = residual.data();
+    float* z = preconditioned.data();
+    float* p = direction.data();
+    float* q = product.data();
+    float* x_data = x.data();
+    const float* b_data = b.data();
+
+    std::vector<Sums> partial_rz(chunk_count), partial_rr(chunk_count), partial_bb(chunk_count);
+
+    // r = b - A x, z = M^-1 r, p = z
+    parallel_for_chunks(pool, n, [&](size_t chunk, size_t begin, size_t end) {
+        Sums rz = { 0.0, 0.0, 0.0 }, rr = { 0.0, 0.0, 0.0 }, bb = { 0.0, 0.0, 0.0 };
+        for (size_t i = begin; i < end; i++) {
+            multiply_row(x_data, i, &q[3 * i]);
+            for (int c = 0; c < 3; c++) {
+                size_t k = 3 * i + c;
+                r[k] = b_data[k] - q[k];
+                z[k] = inverse_diagonal[i] * r[k];
+                p[k] = z[k];
+                rz[c] += (double)r[k] * z[k];
+                rr[c] += (double)r[k] * r[k];
+                bb[c] += (double)b_data[k] * b_data[k];
+            }
+        }
+        partial_rz[chunk] = rz;
+        partial_rr[chunk] = rr;
+        partial_bb[chunk] = bb;
+    });
+    Sums rz = add_up(partial_rz), rr = add_up(partial_rr), bb = add_up(partial_bb);
+
+    std::array<bool, 3> converged;
+    auto update_converged = [&]() {
+        bool all = true;
+        for (int c = 0; c < 3; c++) {
+            converged[c] = rr[c] <= (double)tolerance * tolerance * bb[c];
+            all = all && converged[c];
+        }
+        return all;
+    };
+
+    int iteration = 0;
+    std::vector<Sums> partial_pq(chunk_count);
+    while (!update_converged() && iteration < max_iterations) {
+        iteration++;
+
+        // q = A p
+        parallel_for_chunks(pool, n, [&](size_t chunk, size_t begin, size_t end) {
+            Sums pq = { 0.0, 0.0, 0.0 };
+            for (size_t i = begin; i < end; i++) {
+                multiply_row(p, i, &q[3 * i]);
+                for (int c = 0; c < 3; c++)
+                    pq[c] += (double)p[3 * i + c] * q[3 * i + c];
+            }
+            partial_pq[chunk] = pq;
+        });
+        Sums pq = add_up(partial_pq);
+
+        // Columns that have converged are left as they are
+        float alpha[3];
+        for (int c = 0; c < 3; c++)
+            alpha[c] = converged[c] || pq[c] == 0.0 ? 0.0f : (float)(rz[c] / pq[c]);
+
+        // x += alpha p, r -= alpha q, z = M^-1 r
+        parallel_for_chunks(pool, n, [&](size_t chunk, size_t begin, size_t end) {
+            Sums new_rz = { 0.0, 0.0, 0.0 }, new_rr = { 0.0, 0.0, 0.0 };
+            for (size_t i = begin; i < end; i++) {
+                for (int c = 0; c < 3; c++) {
+                    size_t k = 3 * i + c;
+                    x_data[k] += alpha[c] * p[k];
+                    r[k] -= alpha[c] * q[k];
+                    z[k] = inverse_diagonal[i] * r[k];
+                    new_rz[c] += (double)r[k] * z[k];
+                    new_rr[c] += (double)r[k] * r[k];
+                }
+            }
+            partial_rz[chunk] = new_rz;
+            partial_rr[chunk] = new_rr;
+        });
+        Sums new_rz = add_up(partial_rz);
+        rr = add_up(partial_rr);
+
+        float beta[3];
+        for (int c = 0; c < 3; c++)
+            beta[c] = rz[c] == 0.0 ? 0.0f : (float)(new_rz[c] / rz[c]);
+        rz = new_rz;
+
+        // p = z + beta p
+        parallel_for_chunks(pool, n, [&](size_t, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                for (int c = 0; c < 3; c++)
+                    p[3 * i + c] = z[3 * i + c] + beta[c] * p[3 * i + c];
+        });
+    }
+
+    return update_converged();
+}
\ No newline at end of file
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "algebra.h"
+#include "thread_pool.h"
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wignored-attributes"
+#include <Eigen/Sparse>
+#pragma GCC diagnostic pop
+
+// Rows of three values, such as the positions of a mesh
+using RowVectors3 = Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor>;
+
+// Solves A X = B for a sparse symmetric positive definite A with the conjugate
+// gradient method, preconditioned by the diagonal of A. The three columns are
+// solved together, each until its residual is at most tolerance times the norm
+// of its right hand side. X holds the initial guess and receives the solution.
+// The work is spread over the pool if one is given, with the same result for any
+// number of threads. Returns whether every column converged within
+// max_iterations, which it may not if A is badly conditioned or not
+// positive definite.
+bool solve_conjugate_gradient(const Eigen::SparseMatrix<float>& a,
+                              const RowVectors3& b,
+                              RowVectors3& x,
+                              float tolerance,
+                              int max_iterations,
+                              ThreadPool* pool = nullptr);
\ No newline at end of file
@@ -1,6 +1,8 @@
+#include <algorithm>
 #include <stdexcept>
 
 #include "depth_buffer.h"
+#include "simd.h"
 
 DepthBuffer::DepthBuffer(int width, int height)
     : w(width)
@@ -9,11 +11,18 @@ DepthBuffer::DepthBuffer(int width, int height)
     if (width <= 0 || height <= 0)
         throw std::runtime_error("Invalid depth buffer dimensions");
     grid = new float[(size_t)width * (size_t)height];
+
+    blocks_x = (width + block_size - 1) / block_size;
+    blocks_y = (height + block_size - 1) / block_size;
+    min_depths = new float[(size_t)blocks_x * (size_t)blocks_y];
+    max_depths = new float[(size_t)blocks_x * (size_t)blocks_y];
 }
 
 DepthBuffer::~DepthBuffer()
 {
     delete[] grid;
+    delete[] min_depths;
+    delete[] max_depths;
 }
 
 bool DepthBuffer::is_inside(int x, int y)
@@ -32,4 +41,40 @@ void DepthBuffer::clear(float value)
 {
     for (size_t i = 0; i < (size_t)width() * height(); i++)
         grid[i] = value;
+
+    for (size_t i = 0; i < (size_t)blocks_x * blocks_y; i++)
+        min_depths[i] = max_depths[i] = value;
+}
+
+void DepthBuffer::update_block(int block_x, int block_y)
+{
+    static_assert(block_size == simd_width, "A block row must fit in one SIMD vector");
+
+    int x0 = block_x * block_size, x1 = std::min(width(), x0 + block_size);
+    int y0 = block_y * block_size, y1 = std::min(height(), y0 + block_size);
+
+    float min, max;
+    if (x1 - x0 == block_size) {
+        Float8 row_min = Float8::load(&grid[x0 + width() * y0]);
+        Float8 row_max = row_min;
+        for (int y = y0 + 1; y < y1; y++) {
+            Float8 row = Float8::load(&grid[x0 + width() * y]);
+            row_min = ::min(row_min, row);
+            row_max = ::max(row_max, row);
+        }
+        min = horizontal_min(row_min);
+        max = horizontal_max(row_max);
+    } else {
+        // Blocks cut off by the right edge of the buffer
+        min = max = grid[x0 + width() * y0];
+        for (int y = y0; y < y1; y++) {
+            for (int x = x0; x < x1; x++) {
+                min = std::min(min, grid[x + width() * y]);
+                max = std::max(max, grid[x + width() * y]);
+            }
+        }
+    }
+
+    min_depths[block_x + blocks_x * block_y] = min;
+    max_depths[block_x + blocks_x * block_y] = max;
 }
\ No newline at end of file
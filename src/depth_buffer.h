@@ -2,9 +2,15 @@
 
 #include <cstddef>
 
+// A grid of depths. Alongside the per-pixel depths it keeps the nearest and
+// farthest depth of every block of block_size x block_size pixels, so whole
+// blocks can be tested against a primitive before looking at single pixels.
 class DepthBuffer
 {
   public:
+    // Side length of the square blocks that depth bounds are kept for
+    static constexpr int block_size = 8;
+
     DepthBuffer(int width, int height);
     ~DepthBuffer();
 
@@ -17,10 +23,23 @@ class DepthBuffer
 
     float& get_unchecked(int x, int y) { return grid[x + width() * y]; }
 
+    // Bounds of the depths stored in a block. Blocks are indexed by pixel
+    // coordinates divided by block_size.
+    float block_min(int block_x, int block_y) const { return min_depths[block_x + blocks_x * block_y]; }
+    float block_max(int block_x, int block_y) const { return max_depths[block_x + blocks_x * block_y]; }
+
+    // Recomputes the bounds of a block. Must be called after writing to any of
+    // its pixels through get or get_unchecked.
+    void update_block(int block_x, int block_y);
+
     int width() const { return w; }
     int height() const { return h; }
 
   private:
     int w, h;
     float* grid;
+
+    int blocks_x, blocks_y;
+    float* min_depths;
+    float* max_depths;
 };
\ No newline at end of file
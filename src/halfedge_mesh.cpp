@@ -0,0 +1,111 @@
+#include "halfedge_mesh.h"
+
+#include <algorithm>
+
+// Groups the given items by a key below key_count with a counting sort. Returns
+// the offsets of the groups (key_count + 1 of them) and fills in the items in
+// order of their keys, keeping the order of items with the same key.
+template <typename Key>
+static std::vector<uint32_t> group_by(size_t item_count, size_t key_count, Key key, std::vector<uint32_t>& grouped)
+{
+    std::vector<uint32_t> offsets(key_count + 1, 0);
+    for (uint32_t i = 0; i < item_count; i++)
+        offsets[key(i) + 1]++;
+    for (size_t k = 0; k < key_count; k++)
+        offsets[k + 1] += offsets[k];
+
+    std::vector<uint32_t> positions(offsets.begin(), offsets.end() - 1);
+    grouped.resize(item_count);
+    for (uint32_t i = 0; i < item_count; i++)
+        grouped[positions[key(i)]++] = i;
+    return offsets;
+}
+
+HalfedgeMesh::HalfedgeMesh(const std::vector<IndexedTriangle>& triangles, size_t vertex_count)
+{
+    const uint32_t halfedge_count = 3 * triangles.size();
+
+    origins.resize(halfedge_count);
+    for (size_t f = 0; f < triangles.size(); f++)
+        for (int k = 0; k < 3; k++)
+            origins[3 * f + k] = triangles[f].position_indices[k];
+
+    auto destination = [&](uint32_t h) { return origins[next(h)]; };
+
+    // Match up the halfedges along the same edge, regardless of their direction,
+    // by grouping them by the lower of their two vertices. The groups are small,
+    // as they only hold the edges around one vertex.
+    std::vector<uint32_t> by_lower_vertex;
+    std::vector<uint32_t> lower_offsets = group_by(
+        halfedge_count, vertex_count,
+        [&](uint32_t h) { return std::min(origins[h], destination(h)); },
+        by_lower_vertex);
+
+    std::vector<uint32_t> mates(halfedge_count, none);
+    for (size_t v = 0; v < vertex_count; v++) {
+        auto group_begin = by_lower_vertex.begin() + lower_offsets[v];
+        auto group_end = by_lower_vertex.begin() + lower_offsets[v + 1];
+        auto upper_vertex = [&](uint32_t h) { return std::max(origins[h], destination(h)); };
+        std::sort(group_begin, group_end, [&](uint32_t a, uint32_t b) {
+            return upper_vertex(a) < upper_vertex(b) || (upper_vertex(a) == upper_vertex(b) && a < b);
+        });
+
+        // Only edges with exactly two halfedges are paired
+        for (auto it = group_begin; it != group_end;) {
+            auto same_edge_end = it + 1;
+            while (same_edge_end != group_end && upper_vertex(*same_edge_end) == upper_vertex(*it))
+                same_edge_end++;
+            if (same_edge_end - it == 2) {
+                mates[it[0]] = it[1];
+                mates[it[1]] = it[0];
+            }
+            it = same_edge_end;
+        }
+    }
+
+    // Orient the triangles, spreading out from the first triangle of each connected
+    // part. Two triangles agree if they go along their shared edge in opposite
+    // directions, so a triangle is reversed if it goes the same way as a neighbour
+    // that is not, or the other way around. Triangles that cannot agree with all
+    // their neighbours (in non-orientable meshes) keep the first orientation found.
+    std::vector<char> reversed(triangles.size(), 0), visited(triangles.size(), 0);
+    std::vector<uint32_t> queue;
+    for (uint32_t first = 0; first < triangles.size(); first++) {
+        if (visited[first])
+            continue;
+        visited[first] = 1;
+        queue.assign(1, first);
+        for (size_t q = 0; q < queue.size(); q++) {
+            uint32_t f = queue[q];
+            for (uint32_t h = 3 * f; h < 3 * f + 3; h++) {
+                uint32_t mate = mates[h];
+                if (mate == none || visited[face(mate)])
+                    continue;
+                bool same_direction = origins[h] == origins[mate];
+                reversed[face(mate)] = reversed[f] != same_direction;
+                visited[face(mate)] = 1;
+                queue.push_back(face(mate));
+            }
+        }
+    }
+
+    // Reversing a triangle swaps its corners 1 and 2, which turns its halfedges
+    // 0, 1 and 2 into 2, 1 and 0
+    auto oriented = [&](uint32_t h) {
+        uint32_t f = face(h);
+        return reversed[f] ? 3 * f + (2 - h % 3) : h;
+    };
+    for (size_t f = 0; f < triangles.size(); f++)
+        if (reversed[f])
+            std::swap(origins[3 * f + 1], origins[3 * f + 2]);
+
+    flips.assign(halfedge_count, none);
+    for (uint32_t h = 0; h < halfedge_count; h++)
+        if (mates[h] != none)
+            flips[oriented(h)] = oriented(mates[h]);
+
+    outgoing_offsets = group_by(
+        halfedge_count, vertex_count,
+        [&](uint32_t h) { return origins[h]; },
+        outgoing_halfedges);
+}
\ No newline at end of file
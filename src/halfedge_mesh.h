@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "mesh.h"
+
+// The connectivity of a triangle mesh as halfedges stored in flat arrays. The
+// halfedges of triangle f are 3f, 3f + 1 and 3f + 2, going out of its corners 0,
+// 1 and 2 in turn. The triangles of each connected part of the mesh are oriented
+// like its first triangle where possible, so a triangle's corners may be in the
+// opposite order to the mesh's.
+class HalfedgeMesh
+{
+  public:
+    // Stands for a missing halfedge
+    static constexpr uint32_t none = std::numeric_limits<uint32_t>::max();
+
+    HalfedgeMesh(const std::vector<IndexedTriangle>& triangles, size_t vertex_count);
+
+    size_t vertex_count() const { return outgoing_offsets.size() - 1; }
+    size_t face_count() const { return origins.size() / 3; }
+
+    // The vertex that the halfedge goes out of
+    uint32_t origin(uint32_t halfedge) const { return origins[halfedge]; }
+    uint32_t face(uint32_t halfedge) const { return halfedge / 3; }
+    uint32_t next(uint32_t halfedge) const { return halfedge % 3 == 2 ? halfedge - 2 : halfedge + 1; }
+    uint32_t prev(uint32_t halfedge) const { return halfedge % 3 == 0 ? halfedge + 2 : halfedge - 1; }
+    // The halfedge along the same edge in the other direction, or none if the edge
+    // is on a boundary or shared by more than two triangles
+    uint32_t flip(uint32_t halfedge) const { return flips[halfedge]; }
+
+    // The halfedges going out of vertex v, one for each triangle around it, are
+    // outgoing(k) for k from first_outgoing(v) up to first_outgoing(v + 1)
+    uint32_t first_outgoing(uint32_t vertex) const { return outgoing_offsets[vertex]; }
+    uint32_t outgoing(uint32_t k) const { return outgoing_halfedges[k]; }
+
+  private:
+    std::vector<uint32_t> origins;
+    std::vector<uint32_t> flips;
+
+    std::vector<uint32_t> outgoing_offsets;
+    std::vector<uint32_t> outgoing_halfedges;
+};
\ No newline at end of file
@@ -8,8 +8,8 @@
 Scene ibar_scene()
 {
     return Scene(
-        std::vector<MeshBuffers>(),
-        std::vector<Instance>(),
+        std::vector<std::shared_ptr<const MeshBuffers>>(),
+        InstanceArray(),
         std::vector<PointLight>(),
         Camera(
             translation(Vec3(0.0f, 0.0f, 40.0f)),
@@ -35,20 +35,4 @@ Colour& Image::get(int x, int y)
     if (!is_inside(x, y))
         throw std::runtime_error("Out of bounds");
     return grid[x + width() * y];
-}
-
-std::string Image::to_ppm() const
-{
-    std::string res = "P3\n";
-    res += std::to_string(width()) + " " + std::to_string(height()) + "\n";
-    res += "255\n";
-
-    for (size_t i = 0; i < width() * height(); i++) {
-        Colour& c = grid[i];
-        res += std::to_string(Colour::to_byte(c.r)) + " " +
-               std::to_string(Colour::to_byte(c.g)) + " " +
-               std::to_string(Colour::to_byte(c.b)) + "\n";
-    }
-
-    return res;
 }
\ No newline at end of file
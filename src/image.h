@@ -1,7 +1,6 @@
 #pragma once
 
 #include <cstddef>
-#include <string>
 
 #include "algebra.h"
 #include "colour.h"
@@ -23,7 +22,8 @@ class Image
 
     Colour& get_unchecked(int x, int y) { return grid[x + width() * y]; }
 
-    std::string to_ppm() const;
+    // The colours of row y, followed by those of the rows below it
+    const Colour* row(int y) const { return grid + (size_t)width() * y; }
 
     int width() const { return w; }
     int height() const { return h; }
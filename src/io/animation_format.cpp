@@ -36,23 +36,23 @@ static size_t parse_frame_count(TokenStream& lines)
             continue;
         else if (tokens.size() != 1)
             throw std::runtime_error("Frame count not found");
-        return std::stoull(tokens.next());
+        return parse_unsigned(tokens.next());
     }
     throw std::runtime_error("Frame count not found");
 }
 
 // Parses a line and updates the parser's state accordingly
-static void parse_line(const std::string& line,
+static void parse_line(std::string_view line,
                        AnimationParserState& state)
 {
     TokenStream tokens(line, ' ');
 
     if (tokens.done())
         return;
-    const std::string& tok = tokens.next();
+    std::string_view tok = tokens.next();
 
     if (tok == "Frame") {
-        state.frames.push_back(KeyFrame(std::stoull(tokens.next()), Frame()));
+        state.frames.push_back(KeyFrame(parse_unsigned(tokens.next()), Frame()));
     } else if (tok == "translation") {
         if (state.frames.size() == 0)
             throw std::runtime_error("No frame to translate");
@@ -61,7 +61,7 @@ static void parse_line(const std::string& line,
         if (state.frames.size() == 0)
             throw std::runtime_error("No frame to rotate");
         Vec3 axis = parse_vector(tokens);
-        float angle = std::stof(tokens.next());
+        float angle = parse_float(tokens.next());
         state.frames[state.frames.size() - 1].get_frame().rotation =
             Quaternion::from_rotation(axis, angle / 180.0f * 3.1415f);
     } else if (tok == "scale") {
@@ -69,7 +69,7 @@ static void parse_line(const std::string& line,
             throw std::runtime_error("No frame to scale");
         state.frames[state.frames.size() - 1].get_frame().scale = parse_vector(tokens);
     } else {
-        throw std::runtime_error("Unrecognised token " + tok);
+        throw std::runtime_error("Unrecognised token " + std::string(tok));
     }
 }
 
@@ -0,0 +1,179 @@
+#include <climits>
+#include <optional>
+#include <stdexcept>
+
+#include "batch_format.h"
+#include "ioutil.h"
+#include "parseutil.h"
+#include "token_stream.h"
+
+// The settings of the job being parsed
+struct BatchJobState
+{
+    std::optional<std::string> scene_path;
+    std::optional<int> width, height;
+    std::optional<std::string> output_path;
+    std::optional<ImageFormat> format;
+    SoftwareRenderMode mode = SoftwareRenderMode::Phong;
+
+    std::optional<Mat4> camera_translation;
+    std::optional<Mat4> camera_rotation;
+
+    // Frustum, with the defaults of the scene format
+    bool has_frustum = false;
+    float near = 1.0f, far = 100.0f;
+    float left = -1.0f, right = 1.0f, top = 1.0f, bottom = -1.0f;
+};
+
+static std::string resolve_path(std::string_view path, const std::string& manifest_dir)
+{
+    if (!path.empty() && path[0] == '/')
+        return std::string(path);
+    return manifest_dir + std::string(path);
+}
+
+static SoftwareRenderMode parse_mode(std::string_view name)
+{
+    if (name == "gouraud")
+        return SoftwareRenderMode::Gouraud;
+    if (name == "phong")
+        return SoftwareRenderMode::Phong;
+    if (name == "deferred")
+        return SoftwareRenderMode::DeferredPhong;
+    if (name == "wireframe")
+        return SoftwareRenderMode::Wireframe;
+    throw std::runtime_error("Mode " + std::string(name) + " is not gouraud, phong, deferred or wireframe");
+}
+
+static int parse_size(std::string_view token)
+{
+    uint64_t size = parse_unsigned(token);
+    if (size == 0 || size > INT_MAX)
+        throw std::runtime_error("Image size " + std::string(token) + " is not a positive integer");
+    return size;
+}
+
+static BatchJob finish_job(const BatchJobState& state, const std::string& job_name, bool require_output)
+{
+    if (!state.scene_path)
+        throw std::runtime_error(job_name + " has no scene");
+    if (!state.width)
+        throw std::runtime_error(job_name + " has no size");
+    if (require_output && !state.output_path)
+        throw std::runtime_error(job_name + " has no output");
+
+    BatchJob job;
+    job.scene_path = *state.scene_path;
+    job.width = *state.width;
+    job.height = *state.height;
+    job.mode = state.mode;
+    job.output_path = state.output_path.value_or("");
+    if (state.format)
+        job.format = *state.format;
+    else if (state.output_path)
+        job.format = image_format_of(job.output_path);
+    else
+        job.format = ImageFormat::Ppm;
+    job.camera_translation = state.camera_translation;
+    job.camera_rotation = state.camera_rotation;
+    if (state.has_frustum)
+        job.camera_projection = projection(state.near, state.far, state.left, state.right, state.top, state.bottom);
+    return job;
+}
+
+// Parses a line within a job and updates the job accordingly
+static void parse_job_line(TokenStream& tokens, const std::string& manifest_dir, BatchJobState& state)
+{
+    std::string_view tok = tokens.next();
+
+    if (tok == "scene") {
+        state.scene_path = resolve_path(tokens.next(), manifest_dir);
+    } else if (tok == "size") {
+        if (tokens.remaining() != 2)
+            throw std::runtime_error("Size did not have a width and height");
+        state.width = parse_size(tokens.next());
+        state.height = parse_size(tokens.next());
+    } else if (tok == "output") {
+        state.output_path = resolve_path(tokens.next(), manifest_dir);
+    } else if (tok == "format") {
+        state.format = image_format_from_name(std::string(tokens.next()));
+    } else if (tok == "mode") {
+        state.mode = parse_mode(tokens.next());
+    } else if (tok == "position") {
+        state.camera_translation = parse_translation(tokens);
+    } else if (tok == "orientation") {
+        state.camera_rotation = parse_rotation(tokens);
+    } else if (tok == "near") {
+        state.near = parse_float(tokens.next());
+        state.has_frustum = true;
+    } else if (tok == "far") {
+        state.far = parse_float(tokens.next());
+        state.has_frustum = true;
+    } else if (tok == "left") {
+        state.left = parse_float(tokens.next());
+        state.has_frustum = true;
+    } else if (tok == "right") {
+        state.right = parse_float(tokens.next());
+        state.has_frustum = true;
+    } else if (tok == "top") {
+        state.top = parse_float(tokens.next());
+        state.has_frustum = true;
+    } else if (tok == "bottom") {
+        state.bottom = parse_float(tokens.next());
+        state.has_frustum = true;
+    } else {
+        throw std::runtime_error("Unrecognised token in job " + std::string(tok));
+    }
+}
+
+std::vector<BatchJob> read_batch(const std::string& raw, const std::string& manifest_dir)
+{
+    std::string chars_to_remove = "\r\t";
+    std::string filtered = raw;
+    filter_string(filtered, chars_to_remove);
+
+    TokenStream lines(filtered, '\n');
+
+    std::vector<BatchJob> jobs;
+    std::optional<BatchJobState> state;
+
+    while (!lines.done()) {
+        TokenStream tokens(lines.next(), ' ');
+        if (tokens.done())
+            continue;
+
+        if (tokens.current() == "job:") {
+            if (state.has_value())
+                jobs.push_back(finish_job(state.value(), "Job " + std::to_string(jobs.size() + 1), true));
+            state = BatchJobState();
+        } else if (state.has_value()) {
+            parse_job_line(tokens, manifest_dir, state.value());
+        } else {
+            throw std::runtime_error("Unrecognised token " + std::string(tokens.current()));
+        }
+    }
+
+    // The last job is not followed by another one that finishes it
+    if (state.has_value())
+        jobs.push_back(finish_job(state.value(), "Job " + std::to_string(jobs.size() + 1), true));
+
+    return jobs;
+}
+
+BatchJob read_batch_job(const std::string& raw, const std::string& base_dir)
+{
+    std::string chars_to_remove = "\r\t";
+    std::string filtered = raw;
+    filter_string(filtered, chars_to_remove);
+
+    TokenStream lines(filtered, '\n');
+
+    BatchJobState state;
+    while (!lines.done()) {
+        TokenStream tokens(lines.next(), ' ');
+        if (!tokens.done())
+            parse_job_line(tokens, base_dir, state);
+    }
+
+    return finish_job(state, "Job", false);
+}
\ No newline at end of file
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "batch_renderer.h"
+
+// Reads a batch manifest: a list of jobs, each starting with a line "job:" and
+// followed by its settings, one per line.
+//
+//   scene PATH              the scene file to render (required)
+//   size WIDTH HEIGHT       the image size in pixels (required)
+//   output PATH             where to write the image (required)
+//   format FORMAT           ppm, pfm or qoi (default from the extension of the output)
+//   mode MODE               gouraud, phong, deferred or wireframe (default phong)
+//   position X Y Z          replaces the camera position of the scene
+//   orientation X Y Z ANGLE replaces the camera orientation of the scene
+//   near, far, left, right, top, bottom VALUE
+//                           replace the camera frustum of the scene. Values that
+//                           are not given take the defaults of the scene format.
+//
+// Relative paths are relative to the directory of the manifest, given as
+// manifest_dir.
+std::vector<BatchJob> read_batch(const std::string& raw, const std::string& manifest_dir);
+
+// Reads the settings of a single job, written like in a manifest but without the
+// "job:" line. The output is optional; without it the job's output path is empty
+// and its format defaults to ppm.
+BatchJob read_batch_job(const std::string& raw, const std::string& base_dir);
\ No newline at end of file
@@ -0,0 +1,232 @@
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <unistd.h>
+
+#include "binary_mesh_format.h"
+#include "ioutil.h"
+#include "obj_format.h"
+
+static_assert(sizeof(Vec3) == 3 * sizeof(float), "Vec3 must be three packed floats");
+static_assert(sizeof(IndexedTriangle) == 6 * sizeof(uint32_t), "IndexedTriangle must be six packed indices");
+
+static const char binary_mesh_magic[8] = { 'M', 'E', 'S', 'H', 'B', 'I', 'N', '\0' };
+static constexpr uint32_t binary_mesh_version = 1;
+// Reads differently on machines with the other byte order
+static constexpr uint32_t byte_order_mark = 0x01020304;
+
+struct BinaryMeshHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+
+    uint64_t position_count;
+    uint64_t normal_count;
+    uint64_t triangle_count;
+
+    uint64_t positions_offset;
+    uint64_t normals_offset;
+    uint64_t triangles_offset;
+
+    float bounds_min[3];
+    float bounds_max[3];
+
+    // Of the three arrays, in order
+    uint64_t content_hash;
+};
+
+static uint64_t align_offset(uint64_t offset)
+{
+    return (offset + 15) & ~(uint64_t)15;
+}
+
+// FNV-1a over 64-bit words rather than bytes, for speed
+static uint64_t hash_bytes(const void* data, size_t size, uint64_t hash)
+{
+    const auto* bytes = (const unsigned char*)data;
+    for (; size >= 8; size -= 8, bytes += 8) {
+        uint64_t word;
+        std::memcpy(&word, bytes, 8);
+        hash = (hash ^ word) * 0x100000001b3ull;
+    }
+    for (; size > 0; size--, bytes++)
+        hash = (hash ^ *bytes) * 0x100000001b3ull;
+    return hash;
+}
+
+static uint64_t hash_arrays(const void* positions, size_t position_bytes,
+                            const void* normals, size_t normal_bytes,
+                            const void* triangles, size_t triangle_bytes)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    hash = hash_bytes(positions, position_bytes, hash);
+    hash = hash_bytes(normals, normal_bytes, hash);
+    return hash_bytes(triangles, triangle_bytes, hash);
+}
+
+std::string binary_mesh_path(const std::string& obj_path)
+{
+    return obj_path + ".bin";
+}
+
+Mesh read_binary_mesh(const std::string& path)
+{
+    MappedFile file(path);
+    std::string_view contents = file.contents();
+
+    BinaryMeshHeader header;
+    if (contents.size() < sizeof(header))
+        throw std::runtime_error("Binary mesh " + path + " is truncated");
+    std::memcpy(&header, contents.data(), sizeof(header));
+
+    if (std::memcmp(header.magic, binary_mesh_magic, sizeof(header.magic)) != 0)
+        throw std::runtime_error(path + " is not a binary mesh");
+    if (header.version != binary_mesh_version || header.byte_order != byte_order_mark)
+        throw std::runtime_error("Binary mesh " + path + " has an unsupported version or byte order");
+
+    // The counts are checked against the file size before they are multiplied, so
+    // that the products cannot overflow
+    auto check_array = [&](uint64_t offset, uint64_t count, size_t element_size) {
+        if (offset > contents.size() || count > (contents.size() - offset) / element_size)
+            throw std::runtime_error("Binary mesh " + path + " is truncated");
+        return contents.data() + offset;
+    };
+    const char* positions = check_array(header.positions_offset, header.position_count, sizeof(Vec3));
+    const char* normals = check_array(header.normals_offset, header.normal_count, sizeof(Vec3));
+    const char* triangles = check_array(header.triangles_offset, header.triangle_count, sizeof(IndexedTriangle));
+
+    size_t position_bytes = header.position_count * sizeof(Vec3);
+    size_t normal_bytes = header.normal_count * sizeof(Vec3);
+    size_t triangle_bytes = header.triangle_count * sizeof(IndexedTriangle);
+    if (hash_arrays(positions, position_bytes, normals, normal_bytes, triangles, triangle_bytes) != header.content_hash)
+        throw std::runtime_error("Binary mesh " + path + " is corrupt");
+
+    std::vector<Vec3> mesh_positions(header.position_count);
+    std::vector<Vec3> mesh_normals(header.normal_count);
+    std::vector<IndexedTriangle> mesh_triangles(header.triangle_count);
+    std::memcpy((void*)mesh_positions.data(), positions, position_bytes);
+    std::memcpy((void*)mesh_normals.data(), normals, normal_bytes);
+
+    // A file can have the right hash and still refer to vertices it does not have,
+    // so the indices are checked as the triangles are copied
+    for (size_t t = 0; t < mesh_triangles.size(); t++) {
+        IndexedTriangle& tri = mesh_triangles[t];
+        std::memcpy(&tri, triangles + t * sizeof(IndexedTriangle), sizeof(IndexedTriangle));
+        for (int i = 0; i < 3; i++)
+            if (tri.position_indices[i] >= header.position_count || tri.normal_indices[i] >= header.normal_count)
+                throw std::runtime_error("Binary mesh " + path + " has a triangle with an index out of range");
+    }
+
+    return Mesh(std::move(mesh_positions), std::move(mesh_normals), std::move(mesh_triangles));
+}
+
+void write_binary_mesh(const Mesh& mesh, const std::string& path)
+{
+    const std::vector<Vec3>& positions = mesh.get_vertex_positions();
+    const std::vector<Vec3>& normals = mesh.get_vertex_normals();
+    const std::vector<IndexedTriangle>& triangles = mesh.get_indexed_triangles();
+
+    size_t position_bytes = positions.size() * sizeof(Vec3);
+    size_t normal_bytes = normals.size() * sizeof(Vec3);
+    size_t triangle_bytes = triangles.size() * sizeof(IndexedTriangle);
+
+    BinaryMeshHeader header = {};
+    std::memcpy(header.magic, binary_mesh_magic, sizeof(header.magic));
+    header.version = binary_mesh_version;
+    header.byte_order = byte_order_mark;
+    header.position_count = positions.size();
+    header.normal_count = normals.size();
+    header.triangle_count = triangles.size();
+    header.positions_offset = align_offset(sizeof(header));
+    header.normals_offset = align_offset(header.positions_offset + position_bytes);
+    header.triangles_offset = align_offset(header.normals_offset + normal_bytes);
+
+    if (!positions.empty()) {
+        Vec3 bounds_min = positions[0], bounds_max = positions[0];
+        for (const Vec3& p : positions) {
+            bounds_min = bounds_min.cwiseMin(p);
+            bounds_max = bounds_max.cwiseMax(p);
+        }
+        for (int i = 0; i < 3; i++) {
+            header.bounds_min[i] = bounds_min[i];
+            header.bounds_max[i] = bounds_max[i];
+        }
+    }
+
+    header.content_hash = hash_arrays(positions.data(), position_bytes,
+                                      normals.data(), normal_bytes,
+                                      triangles.data(), triangle_bytes);
+
+    // Written to a temporary file that replaces the old one once complete, so that
+    // others reading the mesh at the same time never see a partial file. The name
+    // is unique to this process and call, as the same mesh may be written by other
+    // processes or other threads of this one at the same time.
+    static std::atomic<uint64_t> temp_file_counter(0);
+    std::string temp_path = path + ".tmp" + std::to_string(::getpid()) + "." + std::to_string(temp_file_counter++);
+    {
+        std::ofstream stream(temp_path, std::ios::binary | std::ios::trunc);
+        if (stream.fail())
+            throw std::runtime_error("Could not open file " + temp_path);
+
+        const char padding[16] = {};
+        auto write_array = [&](uint64_t offset, const void* data, size_t size) {
+            stream.write(padding, offset - stream.tellp());
+            stream.write((const char*)data, size);
+        };
+        stream.write((const char*)&header, sizeof(header));
+        write_array(header.positions_offset, positions.data(), position_bytes);
+        write_array(header.normals_offset, normals.data(), normal_bytes);
+        write_array(header.triangles_offset, triangles.data(), triangle_bytes);
+
+        stream.close();
+        if (stream.fail()) {
+            std::remove(temp_path.c_str());
+            throw std::runtime_error("Could not write file " + temp_path);
+        }
+    }
+
+    if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+        std::remove(temp_path.c_str());
+        throw std::runtime_error("Could not write file " + path);
+    }
+}
+
+bool binary_mesh_up_to_date(const std::string& obj_path)
+{
+    std::error_code error;
+    auto binary_time = std::filesystem::last_write_time(binary_mesh_path(obj_path), error);
+    if (error)
+        return false;
+
+    // Without the obj file, the binary version is all there is
+    auto obj_time = std::filesystem::last_write_time(obj_path, error);
+    return error || binary_time >= obj_time;
+}
+
+Mesh read_obj_cached(const std::string& obj_path, ThreadPool* pool)
+{
+    std::string binary_path = binary_mesh_path(obj_path);
+
+    if (binary_mesh_up_to_date(obj_path)) {
+        try {
+            return read_binary_mesh(binary_path);
+        } catch (const std::exception&) {
+            // Parsed again and rewritten below
+        }
+    }
+
+    Mesh mesh = read_obj_file(obj_path, pool);
+
+    // The binary version only saves time, so failing to write it (for example in a
+    // read-only directory) is not an error
+    try {
+        write_binary_mesh(mesh, binary_path);
+    } catch (const std::exception&) {
+    }
+
+    return mesh;
+}
\ No newline at end of file
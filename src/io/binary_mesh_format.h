@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+
+#include "mesh.h"
+#include "thread_pool.h"
+
+// A binary mesh file holds the arrays of a mesh exactly as they are laid out in
+// memory, so reading one is a bulk copy out of a memory map rather than parsing.
+// The file starts with a header giving the element counts, the offsets of the
+// arrays (aligned to 16 bytes), the bounding box of the positions and a hash of
+// the arrays. Files are in the byte order of the machine that wrote them and are
+// rejected by machines with another one.
+
+// Where the binary version of an obj file is kept: next to it, with an added
+// extension
+std::string binary_mesh_path(const std::string& obj_path);
+
+// Throws if the file is not a valid binary mesh
+Mesh read_binary_mesh(const std::string& path);
+
+// Writes the file atomically, so readers never see it half written
+void write_binary_mesh(const Mesh& mesh, const std::string& path);
+
+// Whether the binary version of the obj file exists and is newer than it
+bool binary_mesh_up_to_date(const std::string& obj_path);
+
+// Reads the obj file at the given path, using its binary version instead if that
+// is up to date. Otherwise the obj file is parsed (in parallel on the pool if one
+// is given) and the binary version is written for next time, if possible.
+Mesh read_obj_cached(const std::string& obj_path, ThreadPool* pool = nullptr);
\ No newline at end of file
@@ -0,0 +1,273 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <unistd.h>
+#include <vector>
+
+#include "image_format.h"
+#include "simd.h"
+
+ImageFormat image_format_from_name(const std::string& name)
+{
+    if (name == "ppm")
+        return ImageFormat::Ppm;
+    if (name == "pfm")
+        return ImageFormat::Pfm;
+    if (name == "qoi")
+        return ImageFormat::Qoi;
+    throw std::runtime_error("Image format " + name + " is not ppm, pfm or qoi");
+}
+
+ImageFormat image_format_of(const std::string& path)
+{
+    size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos || path.find_first_of("\\/", dot) != std::string::npos)
+        throw std::runtime_error("No image format for file " + path);
+    return image_format_from_name(path.substr(dot + 1));
+}
+
+void channels_to_bytes(const float* channels, size_t count, unsigned char* bytes)
+{
+    const Float8 zero = Float8::set1(0.0f), one = Float8::set1(1.0f);
+
+    size_t i = 0;
+    for (; i + simd_width <= count; i += simd_width) {
+        // Clamping like to_byte (NaN becomes zero)
+        Float8 v = min(max(Float8::load(channels + i), zero), one);
+
+        // to_byte truncates the exact product v * 255, which the float product can
+        // exceed by rounding up to the next integer. The exact product is
+        // v * 256 - v, and v * 256 - t is exact for the truncated t, so comparing
+        // it against v tells whether the exact product is below t.
+        Int8 t = truncate_to_int(v * Float8::set1(255.0f));
+        int below = ~cmp_ge(v * Float8::set1(256.0f) - to_float(t), v);
+
+        int32_t lanes[simd_width];
+        t.store(lanes);
+        for (int l = 0; l < simd_width; l++)
+            bytes[i + l] = (unsigned char)(lanes[l] - ((below >> l) & 1));
+    }
+
+    for (; i < count; i++)
+        bytes[i] = Colour::to_byte(channels[i]);
+}
+
+// Collects output and writes it to a file descriptor once enough has built up.
+// Without a file descriptor, everything is kept in memory instead.
+class ImageWriter
+{
+  public:
+    explicit ImageWriter(int fd = -1)
+        : fd(fd)
+    {
+        buffer.reserve(capacity);
+    }
+
+    void put(const void* data, size_t size)
+    {
+        const auto* bytes = (const unsigned char*)data;
+        buffer.insert(buffer.end(), bytes, bytes + size);
+        if (fd >= 0 && buffer.size() >= capacity)
+            flush();
+    }
+
+    void put(const std::string& text) { put(text.data(), text.size()); }
+
+    void flush()
+    {
+        if (fd < 0)
+            return;
+
+        size_t written = 0;
+        while (written < buffer.size()) {
+            ssize_t result = ::write(fd, buffer.data() + written, buffer.size() - written);
+            if (result < 0) {
+                if (errno == EINTR)
+                    continue;
+                throw std::runtime_error(std::string("Could not write image: ") + std::strerror(errno));
+            }
+            written += result;
+        }
+        buffer.clear();
+    }
+
+    std::vector<unsigned char>& contents() { return buffer; }
+
+    static constexpr size_t capacity = 1 << 18;
+
+  private:
+    int fd;
+    std::vector<unsigned char> buffer;
+};
+
+// Number of rows that are converted at once
+static int rows_per_block(const Image& image)
+{
+    return std::max<size_t>(1, ImageWriter::capacity / (3 * sizeof(float) * image.width()));
+}
+
+static void write_ppm(const Image& image, ImageWriter& out)
+{
+    out.put("P6\n" + std::to_string(image.width()) + " " + std::to_string(image.height()) + "\n255\n");
+
+    int block = rows_per_block(image);
+    std::vector<unsigned char> bytes((size_t)3 * image.width() * block);
+
+    for (int y = 0; y < image.height(); y += block) {
+        int rows = std::min(block, image.height() - y);
+        size_t count = (size_t)3 * image.width() * rows;
+        channels_to_bytes(image.row(y)->float_ptr(), count, bytes.data());
+        out.put(bytes.data(), count);
+    }
+}
+
+static void write_pfm(const Image& image, ImageWriter& out)
+{
+    // The sign of the scale gives the byte order, negative being little endian
+    uint16_t probe = 1;
+    bool little_endian = *(unsigned char*)&probe == 1;
+    out.put("PF\n" + std::to_string(image.width()) + " " + std::to_string(image.height()) + "\n" +
+            (little_endian ? "-1.0\n" : "1.0\n"));
+
+    // Rows are stored from the bottom up
+    for (int y = image.height() - 1; y >= 0; y--)
+        out.put(image.row(y), sizeof(Colour) * image.width());
+}
+
+// Encodes the image following the QOI specification (qoiformat.org), version 1.0
+static void write_qoi(const Image& image, ImageWriter& out)
+{
+    unsigned char header[14] = { 'q', 'o', 'i', 'f' };
+    for (int i = 0; i < 4; i++) {
+        header[4 + i] = (unsigned char)((uint32_t)image.width() >> (24 - 8 * i));
+        header[8 + i] = (unsigned char)((uint32_t)image.height() >> (24 - 8 * i));
+    }
+    header[12] = 3; // Channels
+    header[13] = 0; // sRGB with linear alpha
+    out.put(header, sizeof(header));
+
+    struct Pixel
+    {
+        unsigned char r, g, b, a;
+    };
+
+    Pixel seen[64] = {};
+    Pixel prev = { 0, 0, 0, 255 };
+    int run = 0;
+
+    int block = rows_per_block(image);
+    std::vector<unsigned char> bytes((size_t)3 * image.width() * block);
+    std::vector<unsigned char> encoded;
+
+    for (int y = 0; y < image.height(); y += block) {
+        int rows = std::min(block, image.height() - y);
+        size_t pixels = (size_t)image.width() * rows;
+        channels_to_bytes(image.row(y)->float_ptr(), 3 * pixels, bytes.data());
+
+        // Every pixel takes at most four bytes
+        encoded.clear();
+        encoded.reserve(4 * pixels);
+
+        for (size_t i = 0; i < pixels; i++) {
+            Pixel px = { bytes[3 * i], bytes[3 * i + 1], bytes[3 * i + 2], 255 };
+
+            if (px.r == prev.r && px.g == prev.g && px.b == prev.b) {
+                if (++run == 62) {
+                    encoded.push_back(0xc0 | (run - 1));
+                    run = 0;
+                }
+                continue;
+            }
+
+            if (run > 0) {
+                encoded.push_back(0xc0 | (run - 1));
+                run = 0;
+            }
+
+            int index = (px.r * 3 + px.g * 5 + px.b * 7 + 255 * 11) % 64;
+            if (seen[index].r == px.r && seen[index].g == px.g && seen[index].b == px.b && seen[index].a == px.a) {
+                encoded.push_back(index);
+            } else {
+                seen[index] = px;
+
+                // Differences wrap around like unsigned bytes
+                int dr = (signed char)(px.r - prev.r);
+                int dg = (signed char)(px.g - prev.g);
+                int db = (signed char)(px.b - prev.b);
+                int dr_dg = dr - dg, db_dg = db - dg;
+
+                if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                    encoded.push_back(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+                } else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7) {
+                    encoded.push_back(0x80 | (dg + 32));
+                    encoded.push_back((dr_dg + 8) << 4 | (db_dg + 8));
+                } else {
+                    encoded.push_back(0xfe);
+                    encoded.push_back(px.r);
+                    encoded.push_back(px.g);
+                    encoded.push_back(px.b);
+                }
+            }
+            prev = px;
+        }
+
+        out.put(encoded.data(), encoded.size());
+    }
+
+    if (run > 0)
+        encoded.assign(1, 0xc0 | (run - 1));
+    else
+        encoded.clear();
+
+    const unsigned char end_marker[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    encoded.insert(encoded.end(), end_marker, end_marker + sizeof(end_marker));
+    out.put(encoded.data(), encoded.size());
+}
+
+static void write_image(const Image& image, ImageFormat format, ImageWriter& out)
+{
+    switch (format) {
+    case ImageFormat::Ppm:
+        write_ppm(image, out);
+        break;
+    case ImageFormat::Pfm:
+        write_pfm(image, out);
+        break;
+    case ImageFormat::Qoi:
+        write_qoi(image, out);
+        break;
+    }
+    out.flush();
+}
+
+void write_image(const Image& image, ImageFormat format, int fd)
+{
+    ImageWriter out(fd);
+    write_image(image, format, out);
+}
+
+std::vector<unsigned char> encode_image(const Image& image, ImageFormat format)
+{
+    ImageWriter out;
+    write_image(image, format, out);
+    return std::move(out.contents());
+}
+
+void write_image(const Image& image, ImageFormat format, const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        throw std::runtime_error("Could not open file " + path);
+
+    try {
+        write_image(image, format, fd);
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+    if (::close(fd) != 0)
+        throw std::runtime_error("Could not write file " + path);
+}
\ No newline at end of file
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "image.h"
+
+enum class ImageFormat
+{
+    // Binary PPM (P6) with 8 bits per channel
+    Ppm,
+    // Portable float map with 32 bits per channel, not clamped
+    Pfm,
+    // The Quite OK Image format, lossless and compressed with 8 bits per channel
+    Qoi
+};
+
+// Gets the format with the given name (ppm, pfm or qoi). Throws if there is none.
+ImageFormat image_format_from_name(const std::string& name);
+
+// Gets the format from the extension of the path (.ppm, .pfm or .qoi). Throws if
+// the extension is none of them.
+ImageFormat image_format_of(const std::string& path);
+
+// Writes the image to the file descriptor in the given format. The file is built
+// and written a block of rows at a time, so it is never held in memory as a whole.
+// Throws if writing fails.
+void write_image(const Image& image, ImageFormat format, int fd);
+
+// Returns the image encoded in the given format
+std::vector<unsigned char> encode_image(const Image& image, ImageFormat format);
+
+// Writes the image to a new file at the given path, replacing any existing file.
+void write_image(const Image& image, ImageFormat format, const std::string& path);
+
+// Converts colour channels to bytes exactly like Colour::to_byte, simd_width
+// channels at a time.
+void channels_to_bytes(const float* channels, size_t count, unsigned char* bytes);
\ No newline at end of file
@@ -0,0 +1,61 @@
+#include <cstring>
+#include <stdexcept>
+
+#include "instance_array_format.h"
+#include "ioutil.h"
+
+static const char instance_array_magic[8] = { 'I', 'N', 'S', 'T', 'A', 'R', 'R', '\0' };
+static constexpr uint32_t instance_array_version = 1;
+// Reads differently on machines with the other byte order
+static constexpr uint32_t byte_order_mark = 0x01020304;
+
+struct InstanceArrayHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+
+    uint64_t transform_count;
+};
+
+static constexpr size_t floats_per_transform = 12;
+
+std::vector<Mat4> read_instance_array(const std::string& path)
+{
+    MappedFile file(path);
+    std::string_view contents = file.contents();
+
+    InstanceArrayHeader header;
+    if (contents.size() < sizeof(header))
+        throw std::runtime_error("Instance array " + path + " is truncated");
+    std::memcpy(&header, contents.data(), sizeof(header));
+
+    if (std::memcmp(header.magic, instance_array_magic, sizeof(header.magic)) != 0)
+        throw std::runtime_error(path + " is not an instance array");
+    if (header.version != instance_array_version || header.byte_order != byte_order_mark)
+        throw std::runtime_error("Instance array " + path + " has an unsupported version or byte order");
+
+    // The transforms fill the rest of the file exactly. The count is checked
+    // against the file size before it is multiplied, so that the product cannot
+    // overflow.
+    constexpr size_t transform_size = floats_per_transform * sizeof(float);
+    size_t data_size = contents.size() - sizeof(header);
+    if (header.transform_count > data_size / transform_size ||
+        header.transform_count * transform_size != data_size)
+        throw std::runtime_error("Instance array " + path + " has the wrong size");
+
+    std::vector<Mat4> transforms(header.transform_count);
+    const char* data = contents.data() + sizeof(header);
+    for (Mat4& transform : transforms) {
+        float rows[floats_per_transform];
+        std::memcpy(rows, data, transform_size);
+        data += transform_size;
+
+        transform << rows[0], rows[1], rows[2], rows[3],
+            rows[4], rows[5], rows[6], rows[7],
+            rows[8], rows[9], rows[10], rows[11],
+            0.0f, 0.0f, 0.0f, 1.0f;
+    }
+
+    return transforms;
+}
\ No newline at end of file
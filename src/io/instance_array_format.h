@@ -0,0 +1,18 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "algebra.h"
+
+// An instance array file holds the transforms of many instances of one mesh, for
+// scenes with too many instances to list one by one. It is meant to be written by
+// other tools, so the layout is simple: the eight bytes "INSTARR\0", the version
+// (1) and the byte order mark 0x01020304 as 32-bit integers, and the number of
+// transforms as a 64-bit integer, followed by the transforms as the top three
+// rows of their matrices (twelve floats each in row-major order, the bottom row
+// being 0 0 0 1). Numbers are in the byte order of the machine that wrote the
+// file, and files with the other byte order are rejected.
+
+// Throws if the file is not a valid instance array
+std::vector<Mat4> read_instance_array(const std::string& path);
\ No newline at end of file
@@ -1,7 +1,12 @@
 #include <algorithm>
 #include <cstring>
+#include <fcntl.h>
 #include <fstream>
+#include <stdexcept>
 #include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "ioutil.h"
 
@@ -27,4 +32,41 @@ std::string directory_of(const std::string& file)
 {
     size_t i = file.find_last_of("\\/");
     return std::string::npos == i ? "" : file.substr(0, i + 1);
+}
+
+MappedFile::MappedFile(const std::string& path)
+    : data(nullptr)
+    , size(0)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error("Could not open file " + path);
+
+    struct stat info;
+    if (::fstat(fd, &info) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Could not open file " + path);
+    }
+
+    // Empty files cannot be mapped, but there is nothing to map anyway
+    size = info.st_size;
+    if (size > 0) {
+        void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            ::close(fd);
+            throw std::runtime_error("Could not map file " + path);
+        }
+        // The file is read once from start to end
+        ::madvise(mapping, size, MADV_SEQUENTIAL);
+        data = (const char*)mapping;
+    }
+
+    // The mapping stays valid without the descriptor
+    ::close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (size > 0)
+        ::munmap((void*)data, size);
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 
 // Reads the entire file as a string and returns it.
 std::string str_from_file(const std::string& path);
@@ -10,4 +11,22 @@ void filter_string(std::string& raw, const std::string& chars_to_remove);
 
 // Gets the directory of a given file. Includes the final separator (/ or \)
 // unless there is no directory given.
-std::string directory_of(const std::string& file);
\ No newline at end of file
+std::string directory_of(const std::string& file);
+
+// A read-only view of a whole file, mapped into memory rather than copied
+class MappedFile
+{
+  public:
+    // Throws if the file cannot be opened or mapped
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(MappedFile const&) = delete;
+    void operator=(MappedFile const&) = delete;
+
+    std::string_view contents() const { return std::string_view(data, size); }
+
+  private:
+    const char* data;
+    size_t size;
+};
\ No newline at end of file
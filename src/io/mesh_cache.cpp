@@ -0,0 +1,72 @@
+#include "binary_mesh_format.h"
+#include "mesh_cache.h"
+
+std::shared_ptr<const MeshBuffers> MeshCache::load(const std::string& identifier, const std::string& path)
+{
+    // Different spellings of the same path should find the same entry
+    std::error_code error;
+    std::string key = std::filesystem::weakly_canonical(path, error).string();
+    if (error)
+        key = path;
+
+    // A file that cannot be inspected is read anyway so that the error is reported
+    // the same way as other failures to read it
+    auto modified = std::filesystem::last_write_time(path, error);
+    if (error)
+        modified = std::filesystem::file_time_type::min();
+
+    std::promise<std::shared_ptr<const MeshBuffers>> promise;
+    Future mesh;
+    bool reader = false;
+    size_t read_number = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = entries.find(key);
+        if (found != entries.end() && found->second.modified == modified) {
+            use_order.splice(use_order.begin(), use_order, found->second.use);
+            mesh = found->second.mesh;
+        } else {
+            if (found != entries.end()) {
+                use_order.erase(found->second.use);
+                entries.erase(found);
+            }
+
+            mesh = promise.get_future().share();
+            read_number = ++read_count;
+            use_order.push_front(key);
+            entries.emplace(key, Entry { mesh, modified, read_number, use_order.begin() });
+            reader = true;
+
+            // Meshes in use elsewhere stay alive until they are no longer needed
+            while (capacity > 0 && entries.size() > capacity) {
+                entries.erase(use_order.back());
+                use_order.pop_back();
+            }
+        }
+    }
+
+    // The file is read without holding the lock so that other files can be read at
+    // the same time. Everyone already waiting for the file sees the same error if
+    // reading fails, but the failure is not kept for later requests.
+    if (reader) {
+        try {
+            promise.set_value(std::make_shared<const MeshBuffers>(identifier, read_obj_cached(path, pool)));
+        } catch (...) {
+            promise.set_exception(std::current_exception());
+
+            std::lock_guard<std::mutex> lock(mutex);
+            auto found = entries.find(key);
+            if (found != entries.end() && found->second.read_number == read_number) {
+                use_order.erase(found->second.use);
+                entries.erase(found);
+            }
+        }
+    }
+    return mesh.get();
+}
+
+size_t MeshCache::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+}
\ No newline at end of file
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <filesystem>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "scene.h"
+#include "thread_pool.h"
+
+// Loads meshes from OBJ files, reading each file only once. The loaded meshes are
+// shared by everyone that asks for the same file. A file that has been modified
+// since it was read is read again. Safe to use from several threads at once.
+class MeshCache
+{
+  public:
+    // Keeps at most the given number of meshes, dropping the least recently used
+    // ones first. A capacity of zero keeps every mesh. Large files are parsed in
+    // parallel on the pool if one is given.
+    explicit MeshCache(size_t capacity = 0, ThreadPool* pool = nullptr)
+        : capacity(capacity)
+        , pool(pool)
+    {
+    }
+
+    MeshCache(MeshCache const&) = delete;
+    void operator=(MeshCache const&) = delete;
+
+    // Returns the mesh in the OBJ file at the given path, reading it if needed. The
+    // identifier is only used when the file is read, so a mesh shared between
+    // scenes keeps the name it was first given. If another thread is already
+    // reading the file, waits for it to finish. Throws if reading fails.
+    std::shared_ptr<const MeshBuffers> load(const std::string& identifier, const std::string& path);
+
+    // Number of meshes currently kept
+    size_t size() const;
+
+    // The pool that loads may be spread over, if any
+    ThreadPool* thread_pool() const { return pool; }
+
+  private:
+    using Future = std::shared_future<std::shared_ptr<const MeshBuffers>>;
+
+    struct Entry
+    {
+        Future mesh;
+        std::filesystem::file_time_type modified;
+        // Tells apart successive reads of the same file
+        size_t read_number;
+        // Position in the use order
+        std::list<std::string>::iterator use;
+    };
+
+    size_t capacity;
+    ThreadPool* pool;
+    size_t read_count = 0;
+
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, Entry> entries;
+    // Keys of the entries, most recently used first
+    std::list<std::string> use_order;
+};
\ No newline at end of file
@@ -1,117 +1,306 @@
+#include <algorithm>
+#include <charconv>
+#include <cstring>
 #include <stdexcept>
 
 #include "ioutil.h"
 #include "obj_format.h"
 #include "parseutil.h"
-#include "token_stream.h"
 
-// A struct that is passed around during the parsing process.
-struct ObjParserState
+// The elements parsed from one chunk of the file, with position and normal
+// indices already global since the file gives them explicitly
+struct ObjChunk
 {
-    ObjParserState()
-    {
-        positions = std::vector<Vec3>();
-        normals = std::vector<Vec3>();
-        tris = std::vector<IndexedTriangle>();
-    }
+    ObjChunk() {}
 
-    ObjParserState(ObjParserState const&) = delete;
-    void operator=(ObjParserState const&) = delete;
+    ObjChunk(ObjChunk const&) = delete;
+    void operator=(ObjChunk const&) = delete;
+
+    // A face without normals, whose normal is computed once all chunks are merged
+    struct GeneratedNormal
+    {
+        // Index of the face in the chunk
+        uint32_t tri;
+        // Number of positions in the chunk before the face
+        uint32_t positions_before;
+    };
 
     std::vector<Vec3> positions;
+    // Both given and generated normals, in the order they appear in the file
     std::vector<Vec3> normals;
     std::vector<IndexedTriangle> tris;
+    std::vector<GeneratedNormal> generated_normals;
+
+    // The first error in the chunk, after which the rest of it is not parsed
+    std::exception_ptr error;
 };
 
-// Assumes the given token stream has the three coordinates as the next tokens
-static void parse_vertex_position(TokenStream& tokens, ObjParserState& state)
+// Tabs and carriage returns only separate tokens like spaces
+static bool is_separator(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Returns the next token in the line and consumes it. Empty once the line is done.
+static std::string_view next_token(std::string_view& line)
 {
-    if (tokens.size() - tokens.current_index() != 3)
-        throw std::runtime_error("Vertex does not have three coordinates");
+    size_t start = 0;
+    while (start < line.size() && is_separator(line[start]))
+        start++;
+    size_t end = start;
+    while (end < line.size() && !is_separator(line[end]))
+        end++;
+
+    std::string_view token = line.substr(start, end - start);
+    line.remove_prefix(end);
+    return token;
+}
 
-    state.positions.push_back(parse_vector(tokens));
+static bool line_done(std::string_view line)
+{
+    return next_token(line).empty();
 }
 
-// Assumes the given token stream has the three coordinates as the next tokens
-static void parse_vertex_normal(TokenStream& tokens, ObjParserState& state)
+// Parses a 1-indexed obj index and returns it 0-indexed
+static uint32_t parse_index(std::string_view token)
 {
-    if (tokens.size() - tokens.current_index() != 3)
-        throw std::runtime_error("Normal does not have three coordinates");
+    const char* last = token.data() + token.size();
 
-    state.normals.push_back(parse_vector(tokens));
+    uint32_t value;
+    auto result = std::from_chars(token.data(), last, value);
+    if (result.ec != std::errc() || result.ptr != last || value == 0)
+        throw std::runtime_error("Invalid index " + std::string(token));
+    return value - 1;
 }
 
-// Assumes the given token stream has the three indices as the next tokens
-static void parse_triangle(TokenStream& tokens, ObjParserState& state)
+// Assumes the line has the three coordinates as the next tokens
+static Vec3 parse_vector(std::string_view& line, const char* error)
 {
-    if (tokens.size() - tokens.current_index() != 3)
-        throw std::runtime_error("Face was not a triangle");
+    Vec3 v;
+    for (int i = 0; i < 3; i++) {
+        std::string_view token = next_token(line);
+        if (token.empty())
+            throw std::runtime_error(error);
+        v[i] = parse_float(token);
+    }
+    if (!line_done(line))
+        throw std::runtime_error(error);
+    return v;
+}
 
+// Assumes the line has the three vertices as the next tokens
+static void parse_triangle(std::string_view& line, ObjChunk& chunk)
+{
     bool no_normals = false;
 
     IndexedTriangle t;
     for (int i = 0; i < 3; i++) {
-        TokenStream vertex_data(tokens.next(), '/');
+        std::string_view vertex_data = next_token(line);
+        if (vertex_data.empty())
+            throw std::runtime_error("Face was not a triangle");
+
+        // The indices are separated by slashes, where empty indices are skipped.
+        // Texture coordinates are currently unsupported, so the second index given
+        // is taken to be the normal.
+        std::string_view indices[2];
+        int index_count = 0;
+        while (!vertex_data.empty() && index_count < 2) {
+            size_t slash = vertex_data.find('/');
+            std::string_view index = vertex_data.substr(0, slash);
+            vertex_data.remove_prefix(slash == std::string_view::npos ? vertex_data.size() : slash + 1);
+            if (!index.empty())
+                indices[index_count++] = index;
+        }
 
         // Note: Obj is 1-indexed and we want 0-indexing.
-        t.position_indices[i] = std::stoul(vertex_data.next()) - 1;
+        t.position_indices[i] = parse_index(indices[0]);
 
-        if (vertex_data.done()) {
+        if (index_count < 2) {
             no_normals = true;
             continue;
         }
 
-        // Note: Texture coordinates currently unsupported
-
-        t.normal_indices[i] = std::stoul(vertex_data.next()) - 1;
+        t.normal_indices[i] = parse_index(indices[1]);
     }
+    if (!line_done(line))
+        throw std::runtime_error("Face was not a triangle");
 
-    // If no normals are attached, generate ones based on the cross product
+    // If no normals are attached, one is generated based on the cross product. The
+    // positions may be in earlier chunks, so only its place is reserved for now,
+    // with the index relative to the chunk.
     if (no_normals) {
-        Vec3 generated_normal = (state.positions[t.position_indices[1]] - state.positions[t.position_indices[0]])
-                                    .cross(state.positions[t.position_indices[2]] - state.positions[t.position_indices[1]]);
-        t.normal_indices[0] = t.normal_indices[1] = t.normal_indices[2] = state.normals.size();
-        state.normals.push_back(generated_normal);
+        chunk.generated_normals.push_back({ (uint32_t)chunk.tris.size(), (uint32_t)chunk.positions.size() });
+        t.normal_indices[0] = t.normal_indices[1] = t.normal_indices[2] = chunk.normals.size();
+        chunk.normals.push_back(Vec3::Zero());
     }
 
-    state.tris.push_back(t);
+    chunk.tris.push_back(t);
 }
 
-static void parse_line(const std::string& line,
-                       ObjParserState& state)
+static void parse_line(std::string_view line, ObjChunk& chunk)
 {
-    TokenStream tokens(line, ' ');
+    std::string_view curr = next_token(line);
 
-    if (tokens.done())
+    if (curr.empty())
         return;
-    const std::string& curr = tokens.next();
 
     if (curr == "v")
-        parse_vertex_position(tokens, state);
+        chunk.positions.push_back(parse_vector(line, "Vertex does not have three coordinates"));
     else if (curr == "vn")
-        parse_vertex_normal(tokens, state);
+        chunk.normals.push_back(parse_vector(line, "Normal does not have three coordinates"));
     else if (curr == "f")
-        parse_triangle(tokens, state);
+        parse_triangle(line, chunk);
     else
-        throw std::runtime_error("Unrecognised token " + curr);
+        throw std::runtime_error("Unrecognised token " + std::string(curr));
 }
 
-Mesh read_obj(const std::string& raw)
+// Counts the lines of each kind so that the output can be allocated up front
+static void reserve_output(std::string_view raw, ObjChunk& chunk)
 {
-    std::string chars_to_remove = "\r\t";
-    std::string filtered = raw;
-    filter_string(filtered, chars_to_remove);
+    size_t positions = 0, normals = 0, tris = 0;
+
+    const char* p = raw.data();
+    const char* end = raw.data() + raw.size();
+    while (p < end) {
+        while (p < end && is_separator(*p))
+            p++;
+        if (end - p >= 2 && p[0] == 'v' && is_separator(p[1]))
+            positions++;
+        else if (end - p >= 3 && p[0] == 'v' && p[1] == 'n' && is_separator(p[2]))
+            normals++;
+        else if (end - p >= 2 && p[0] == 'f' && is_separator(p[1]))
+            tris++;
 
-    TokenStream lines(filtered, '\n');
+        const char* newline = (const char*)std::memchr(p, '\n', end - p);
+        p = newline ? newline + 1 : end;
+    }
+
+    chunk.positions.reserve(positions);
+    // Faces without normals each get a generated one
+    chunk.normals.reserve(normals > 0 ? normals : tris);
+    chunk.tris.reserve(tris);
+}
 
-    ObjParserState state;
+static void parse_chunk(std::string_view raw, ObjChunk& chunk)
+{
+    try {
+        reserve_output(raw, chunk);
 
-    while (!lines.done())
-        parse_line(lines.next(), state);
+        while (!raw.empty()) {
+            size_t newline = raw.find('\n');
+            parse_line(raw.substr(0, newline), chunk);
+            raw.remove_prefix(newline == std::string_view::npos ? raw.size() : newline + 1);
+        }
+    } catch (...) {
+        chunk.error = std::current_exception();
+    }
+}
+
+// Splits the file into about the given number of chunks, at line boundaries
+static std::vector<std::string_view> split_lines(std::string_view raw, size_t chunk_count)
+{
+    std::vector<std::string_view> chunks;
+    size_t target_size = raw.size() / chunk_count + 1;
+    while (!raw.empty()) {
+        size_t newline = raw.size() > target_size ? raw.find('\n', target_size) : std::string_view::npos;
+        size_t size = newline == std::string_view::npos ? raw.size() : newline + 1;
+        chunks.push_back(raw.substr(0, size));
+        raw.remove_prefix(size);
+    }
+    return chunks;
+}
+
+// Smallest part of a file that is worth parsing on its own thread
+static constexpr size_t min_chunk_size = 1 << 20;
+
+Mesh read_obj(std::string_view raw, ThreadPool* pool)
+{
+    size_t chunk_count = 1;
+    if (pool != nullptr) {
+        // A few chunks per thread even out the differences in parsing time
+        size_t thread_count = pool->worker_count() + 1;
+        chunk_count = std::clamp<size_t>(raw.size() / min_chunk_size, 1, 4 * thread_count);
+    }
+
+    std::vector<std::string_view> parts = split_lines(raw, chunk_count);
+    std::vector<ObjChunk> chunks(parts.size());
+    if (pool != nullptr && parts.size() > 1)
+        pool->parallel_for(parts.size(), [&](size_t i) { parse_chunk(parts[i], chunks[i]); });
+    else if (!parts.empty())
+        parse_chunk(parts[0], chunks[0]);
+
+    // Where each chunk starts in the merged arrays
+    struct Offsets
+    {
+        size_t positions, normals, tris;
+    };
+    std::vector<Offsets> offsets(chunks.size() + 1, Offsets { 0, 0, 0 });
+    for (size_t i = 0; i < chunks.size(); i++) {
+        offsets[i + 1].positions = offsets[i].positions + chunks[i].positions.size();
+        offsets[i + 1].normals = offsets[i].normals + chunks[i].normals.size();
+        offsets[i + 1].tris = offsets[i].tris + chunks[i].tris.size();
+    }
+
+    // Reports the error the file would give if it was parsed from start to end
+    for (size_t i = 0; i < chunks.size(); i++) {
+        for (const ObjChunk::GeneratedNormal& generated : chunks[i].generated_normals) {
+            const IndexedTriangle& t = chunks[i].tris[generated.tri];
+            for (int j = 0; j < 3; j++) {
+                if (t.position_indices[j] >= offsets[i].positions + generated.positions_before)
+                    throw std::runtime_error("Face refers to a vertex that is not defined before it");
+            }
+        }
+        if (chunks[i].error)
+            std::rethrow_exception(chunks[i].error);
+    }
+
+    std::vector<Vec3> positions, normals;
+    std::vector<IndexedTriangle> tris;
+
+    auto move_chunk = [&](size_t i) {
+        ObjChunk& chunk = chunks[i];
+        for (const ObjChunk::GeneratedNormal& generated : chunk.generated_normals) {
+            IndexedTriangle& t = chunk.tris[generated.tri];
+            t.normal_indices[0] = t.normal_indices[1] = t.normal_indices[2] = t.normal_indices[0] + offsets[i].normals;
+        }
+        std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + offsets[i].positions);
+        std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + offsets[i].normals);
+        std::copy(chunk.tris.begin(), chunk.tris.end(), tris.begin() + offsets[i].tris);
+    };
+
+    auto generate_normals = [&](size_t i) {
+        for (const ObjChunk::GeneratedNormal& generated : chunks[i].generated_normals) {
+            const IndexedTriangle& t = tris[offsets[i].tris + generated.tri];
+            normals[t.normal_indices[0]] = (positions[t.position_indices[1]] - positions[t.position_indices[0]])
+                                               .cross(positions[t.position_indices[2]] - positions[t.position_indices[1]]);
+        }
+    };
+
+    if (chunks.size() == 1) {
+        // Nothing to merge
+        positions = std::move(chunks[0].positions);
+        normals = std::move(chunks[0].normals);
+        tris = std::move(chunks[0].tris);
+        generate_normals(0);
+    } else if (chunks.size() > 1) {
+        positions.resize(offsets.back().positions);
+        normals.resize(offsets.back().normals);
+        tris.resize(offsets.back().tris);
+
+        // Normals can only be generated once all positions are in place
+        pool->parallel_for(chunks.size(), move_chunk);
+        pool->parallel_for(chunks.size(), generate_normals);
+    }
 
     // Create a dummy normal if there are none
-    if (state.normals.size() == 0)
-        state.normals.push_back(Vec3(0.0f, 1.0f, 0.0f));
+    if (normals.size() == 0)
+        normals.push_back(Vec3(0.0f, 1.0f, 0.0f));
 
-    return Mesh(state.positions, state.normals, state.tris);
+    return Mesh(std::move(positions), std::move(normals), std::move(tris));
+}
+
+Mesh read_obj_file(const std::string& path, ThreadPool* pool)
+{
+    MappedFile file(path);
+    return read_obj(file.contents(), pool);
 }
\ No newline at end of file
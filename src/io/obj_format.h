@@ -1,7 +1,14 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 
 #include "mesh.h"
+#include "thread_pool.h"
 
-Mesh read_obj(const std::string& raw);
+// Parses the contents of an obj file. With a pool, large files are split into
+// chunks that are parsed in parallel, giving the same mesh as a serial parse.
+Mesh read_obj(std::string_view raw, ThreadPool* pool = nullptr);
+
+// Reads the obj file at the given path without copying it into memory first
+Mesh read_obj_file(const std::string& path, ThreadPool* pool = nullptr);
\ No newline at end of file
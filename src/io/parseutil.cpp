@@ -1,71 +1,99 @@
-#include <iostream>
+#include <charconv>
+#include <stdexcept>
+#include <string>
 
 #include "parseutil.h"
 #include "token_stream.h"
 
+float parse_float(std::string_view token)
+{
+    // from_chars does not take a leading plus sign, unlike stof
+    const char* first = token.data();
+    const char* last = token.data() + token.size();
+    if (first != last && *first == '+')
+        first++;
+
+    float value;
+    auto result = std::from_chars(first, last, value);
+    if (result.ec != std::errc() || result.ptr != last || first == last)
+        throw std::runtime_error("Invalid number " + std::string(token));
+    return value;
+}
+
+uint64_t parse_unsigned(std::string_view token)
+{
+    const char* last = token.data() + token.size();
+
+    uint64_t value;
+    auto result = std::from_chars(token.data(), last, value);
+    if (result.ec != std::errc() || result.ptr != last)
+        throw std::runtime_error("Invalid integer " + std::string(token));
+    return value;
+}
+
 Colour parse_colour(TokenStream& tokens)
 {
-    if (tokens.size() - tokens.current_index() < 3)
+    if (tokens.remaining() < 3)
         throw std::runtime_error("Colours need three components");
 
     Colour col;
-    col.r = std::stof(tokens.next());
-    col.g = std::stof(tokens.next());
-    col.b = std::stof(tokens.next());
+    col.r = parse_float(tokens.next());
+    col.g = parse_float(tokens.next());
+    col.b = parse_float(tokens.next());
     return col;
 }
 
 Vec3 parse_vector(TokenStream& tokens)
 {
-    if (tokens.size() - tokens.current_index() < 3)
+    if (tokens.remaining() < 3)
         throw std::runtime_error("Vectors need three components");
 
     Vec3 pos;
-    pos.x() = std::stof(tokens.next());
-    pos.y() = std::stof(tokens.next());
-    pos.z() = std::stof(tokens.next());
+    pos.x() = parse_float(tokens.next());
+    pos.y() = parse_float(tokens.next());
+    pos.z() = parse_float(tokens.next());
     return pos;
 }
 
 Mat4 parse_translation(TokenStream& tokens)
 {
-    if (tokens.size() - tokens.current_index() != 3)
+    if (tokens.remaining() != 3)
         throw std::runtime_error("Translation did not have three coordinates");
 
-    float x = std::stof(tokens.next());
-    float y = std::stof(tokens.next());
-    float z = std::stof(tokens.next());
+    float x = parse_float(tokens.next());
+    float y = parse_float(tokens.next());
+    float z = parse_float(tokens.next());
 
     return translation(Vec3(x, y, z));
 }
 
 Mat4 parse_rotation(TokenStream& tokens)
 {
-    if (tokens.size() - tokens.current_index() != 4)
+    if (tokens.remaining() != 4)
         throw std::runtime_error(
             "Rotation did not have three coordinates and angle");
 
     Vec3 u;
     {
-        float x = std::stof(tokens.next());
-        float y = std::stof(tokens.next());
-        float z = std::stof(tokens.next());
+        float x = parse_float(tokens.next());
+        float y = parse_float(tokens.next());
+        float z = parse_float(tokens.next());
         u = Vec3(x, y, z);
     }
 
-    float angle = std::stof(tokens.next());
+    float angle = parse_float(tokens.next());
 
     return rotation(u, angle);
 }
 
 Mat4 parse_scaling(TokenStream& tokens)
 {
-    if (tokens.size() - tokens.current_index() != 3)
+    if (tokens.remaining() != 3)
         throw std::runtime_error("Scaling did not have three coordinates");
 
-    float x = std::stof(tokens.next());
-    float y = std::stof(tokens.next());
-    float z = std::stof(tokens.next());
+    float x = parse_float(tokens.next());
+    float y = parse_float(tokens.next());
+    float z = parse_float(tokens.next());
 
     return scaling(Vec3(x, y, z));
 }
\ No newline at end of file
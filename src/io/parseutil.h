@@ -1,9 +1,18 @@
 #pragma once
 
+#include <cstdint>
+#include <string_view>
+
 #include "colour.h"
 #include "token_stream.h"
 #include "transform.h"
 
+// Parses the whole token as a number. Throws if it is not one.
+float parse_float(std::string_view token);
+
+// Parses the whole token as a non-negative integer. Throws if it is not one.
+uint64_t parse_unsigned(std::string_view token);
+
 // Assumes the given token stream has the three components as the next tokens
 Colour parse_colour(TokenStream& tokens);
 
@@ -1,26 +1,99 @@
+#include <atomic>
+#include <filesystem>
+#include <future>
 #include <iostream>
 #include <optional>
 #include <stdexcept>
 
+#include "binary_mesh_format.h"
 #include "colour.h"
+#include "instance_array_format.h"
 #include "ioutil.h"
 #include "light.h"
-#include "obj_format.h"
 #include "parseutil.h"
 #include "scene_format.h"
 #include "token_stream.h"
 
+// A mesh that is loaded in the background while the scene is parsed. It is queued
+// on the pool, but run by whichever thread gets to it first, so waiting for it
+// never depends on a worker being free.
+class MeshLoad
+{
+  public:
+    MeshLoad(const std::string& identifier, const std::string& path, MeshCache& mesh_cache)
+        : identifier(identifier)
+        , path(path)
+        , mesh_cache(mesh_cache)
+        , claimed(false)
+        , done(finished.get_future())
+    {
+    }
+
+    void run()
+    {
+        if (claimed.exchange(true))
+            return;
+        try {
+            mesh = mesh_cache.load(identifier, path);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        finished.set_value();
+    }
+
+    // Waits until the mesh is loaded (or has failed to), loading it if no one has
+    // started yet
+    void wait()
+    {
+        run();
+        done.wait();
+    }
+
+    // Throws if loading failed
+    std::shared_ptr<const MeshBuffers> get()
+    {
+        wait();
+        if (error)
+            std::rethrow_exception(error);
+        return mesh;
+    }
+
+  private:
+    std::string identifier;
+    std::string path;
+    MeshCache& mesh_cache;
+
+    std::atomic<bool> claimed;
+    std::promise<void> finished;
+    std::future<void> done;
+
+    std::shared_ptr<const MeshBuffers> mesh;
+    std::exception_ptr error;
+};
+
+// A mesh named in the objects section, which is only loaded once an instance uses it
+struct MeshDeclaration
+{
+    std::string identifier;
+    std::string path;
+    // Index among the meshes of the scene, once it is used
+    std::optional<size_t> mesh_index;
+};
+
 // A state that is passed around when parsing.
 struct SceneParserState
 {
-    SceneParserState(const std::string data_dir)
+    SceneParserState(const std::string data_dir, MeshCache& mesh_cache)
         : data_dir(data_dir)
+        , mesh_cache(mesh_cache)
     {
         current_object = std::nullopt;
         current_transform = Mat4::Identity();
-        meshes = std::vector<MeshBuffers>();
-        mesh_indices = std::unordered_map<std::string, size_t>();
-        instances = std::vector<Instance>();
+        current_array = std::nullopt;
+        mesh_declarations = std::vector<MeshDeclaration>();
+        declaration_indices = std::unordered_map<std::string, size_t>();
+        mesh_loads = std::vector<std::shared_ptr<MeshLoad>>();
+        instances = InstanceArray();
         lights = std::vector<PointLight>();
         camera = std::nullopt;
     }
@@ -29,16 +102,25 @@ struct SceneParserState
     void operator=(SceneParserState const&) = delete;
 
     std::string data_dir;
+    MeshCache& mesh_cache;
 
     std::optional<std::string> current_object;
 
     Mat4 current_transform;
     PhongMaterial current_material;
+    // The transforms of the elements if the current instance is an array of them,
+    // relative to the array as a whole
+    std::optional<std::vector<Mat4>> current_array;
+
+    std::vector<MeshDeclaration> mesh_declarations;
+    // The latest declaration of each identifier
+    std::unordered_map<std::string, size_t> declaration_indices;
 
-    std::vector<MeshBuffers> meshes;
-    std::unordered_map<std::string, size_t> mesh_indices;
+    // One per mesh in the scene, shared between declarations of the same file
+    std::vector<std::shared_ptr<MeshLoad>> mesh_loads;
+    std::unordered_map<std::string, std::shared_ptr<MeshLoad>> mesh_loads_by_path;
 
-    std::vector<Instance> instances;
+    InstanceArray instances;
 
     std::vector<PointLight> lights;
 
@@ -48,7 +130,7 @@ struct SceneParserState
 static void parse_light(TokenStream& tokens,
                         SceneParserState& state)
 {
-    if (tokens.size() - tokens.current_index() != 9)
+    if (tokens.remaining() != 9)
         throw std::runtime_error("Invalid light syntax");
 
     Vec3 pos = parse_vector(tokens);
@@ -61,11 +143,74 @@ static void parse_light(TokenStream& tokens,
     if (tokens.next() != ",")
         throw std::runtime_error("Invalid light syntax");
 
-    float attenuation = std::stof(tokens.next());
+    float attenuation = parse_float(tokens.next());
 
     state.lights.push_back(PointLight(pos, col, attenuation));
 }
 
+// Gets the index of the declared mesh among the meshes of the scene, starting to
+// load it if this is the first time it is used. Parsing carries on while it loads.
+static size_t use_mesh(const std::string& identifier, SceneParserState& state)
+{
+    MeshDeclaration& declaration = state.mesh_declarations[state.declaration_indices.at(identifier)];
+    if (declaration.mesh_index.has_value())
+        return declaration.mesh_index.value();
+
+    std::shared_ptr<MeshLoad>& load = state.mesh_loads_by_path[declaration.path];
+    if (!load) {
+        load = std::make_shared<MeshLoad>(declaration.identifier, declaration.path, state.mesh_cache);
+        ThreadPool* pool = state.mesh_cache.thread_pool();
+        if (pool != nullptr && pool->worker_count() > 0)
+            pool->submit([load]() { load->run(); });
+    }
+
+    declaration.mesh_index = state.mesh_loads.size();
+    state.mesh_loads.push_back(load);
+    return declaration.mesh_index.value();
+}
+
+// Adds the instance (or array of instances) that has been described so far to
+// the scene
+static void finish_instance(SceneParserState& state)
+{
+    // An empty array uses nothing, so its mesh is not loaded
+    if (state.current_array.has_value() && state.current_array.value().empty())
+        return;
+
+    size_t mesh_index = use_mesh(state.current_object.value(), state);
+    uint32_t material_index = state.instances.add_material(state.current_material);
+
+    if (!state.current_array.has_value()) {
+        state.instances.add(mesh_index, state.current_transform, material_index);
+        return;
+    }
+
+    const std::vector<Mat4>& transforms = state.current_array.value();
+    state.instances.reserve(state.instances.size() + transforms.size());
+    for (const Mat4& transform : transforms)
+        state.instances.add(mesh_index, state.current_transform * transform, material_index);
+}
+
+// Starts a new instance of the given mesh, finishing the previous one
+static void start_instance(const std::string& identifier,
+                           std::optional<std::vector<Mat4>> array,
+                           SceneParserState& state)
+{
+    if (!state.declaration_indices.count(identifier))
+        throw std::runtime_error("Object " + identifier + " not recognised");
+
+    // If this is not the first instance in the file, we
+    // finialise the previous instance
+    if (state.current_object.has_value())
+        finish_instance(state);
+
+    // Reset state for new instance
+    state.current_object = identifier;
+    state.current_transform = Mat4::Identity();
+    state.current_material = PhongMaterial();
+    state.current_array = std::move(array);
+}
+
 // Assumes identifier is consumed in stream.
 static void parse_identifier(const std::string& identifier,
                              TokenStream& tokens,
@@ -73,32 +218,75 @@ static void parse_identifier(const std::string& identifier,
 {
     // Identifier alone on a line means a new instance is being created.
     if (tokens.done()) {
-        if (!state.mesh_indices.count(identifier))
-            throw std::runtime_error("Object " + identifier + " not recognised");
-
-        // If this is not the first instance in the file, we
-        // finialise the previous instance
-        if (state.current_object.has_value()) {
-            Instance instance(state.mesh_indices[state.current_object.value()],
-                              state.current_transform,
-                              state.current_material);
-            state.instances.push_back(instance);
-        }
+        start_instance(identifier, std::nullopt, state);
+    } else {
+        // Declare a new mesh from obj with the identifier as the name. It is only
+        // loaded if an instance uses it, but a missing file is reported right away.
+        std::string path = state.data_dir + std::string(tokens.next());
+        std::error_code error;
+        if (!std::filesystem::exists(path, error) && !std::filesystem::exists(binary_mesh_path(path), error))
+            throw std::runtime_error("Could not open file " + path);
+
+        state.declaration_indices[identifier] = state.mesh_declarations.size();
+        state.mesh_declarations.push_back({ identifier, path, std::nullopt });
+    }
+}
 
-        // Reset state for new instance
-        state.current_object = identifier;
-        state.current_transform = Mat4::Identity();
-        state.current_material = PhongMaterial();
+// Parses one transform of an inline instance array: either a translation (three
+// numbers) or the top three rows of the matrix (twelve numbers)
+static Mat4 parse_array_transform(TokenStream& tokens)
+{
+    size_t count = tokens.remaining();
+    if (count == 3)
+        return parse_translation(tokens);
+    if (count != 12)
+        throw std::runtime_error("Invalid instance array transform");
+
+    float rows[12];
+    for (float& value : rows)
+        value = parse_float(tokens.next());
+
+    Mat4 transform;
+    transform << rows[0], rows[1], rows[2], rows[3],
+        rows[4], rows[5], rows[6], rows[7],
+        rows[8], rows[9], rows[10], rows[11],
+        0.0f, 0.0f, 0.0f, 1.0f;
+    return transform;
+}
 
+// Parses an array of instances of one mesh, which is either given inline as
+// "array IDENTIFIER COUNT" followed by one transform per line, or read from an
+// instance array file with "array IDENTIFIER from PATH". The lines that follow
+// (transformations and material) apply to all of the instances at once.
+// Assumes "array" is consumed in stream.
+static void parse_array(TokenStream& tokens, TokenStream& lines, SceneParserState& state)
+{
+    size_t count = tokens.remaining();
+    if (count != 2 && count != 3)
+        throw std::runtime_error("Invalid instance array syntax");
+
+    std::string identifier(tokens.next());
+
+    std::vector<Mat4> transforms;
+    if (count == 3) {
+        if (tokens.next() != "from")
+            throw std::runtime_error("Invalid instance array syntax");
+        transforms = read_instance_array(state.data_dir + std::string(tokens.next()));
     } else {
-        // Load new mesh from obj with the identifier as the name.
-        MeshBuffers m(identifier, read_obj(str_from_file(state.data_dir + tokens.next())));
-        state.mesh_indices[identifier] = state.meshes.size();
-        state.meshes.push_back(m);
+        uint64_t transform_count = parse_unsigned(tokens.next());
+        while (transforms.size() < transform_count) {
+            if (lines.done())
+                throw std::runtime_error("Instance array of " + identifier + " ends early");
+            TokenStream row(lines.next(), ' ');
+            if (!row.done())
+                transforms.push_back(parse_array_transform(row));
+        }
     }
+
+    start_instance(identifier, std::move(transforms), state);
 }
 
-static bool is_section_label(const std::string& token)
+static bool is_section_label(std::string_view token)
 {
     return token[token.size() - 1] == ':';
 }
@@ -117,24 +305,24 @@ static void parse_camera(TokenStream& lines, SceneParserState& state)
 
         if (tokens.done())
             continue;
-        const std::string& tok = tokens.next();
+        std::string_view tok = tokens.next();
 
         if (tok == "position") {
             position = parse_translation(tokens);
         } else if (tok == "orientation") {
             orientation = parse_rotation(tokens);
         } else if (tok == "near") {
-            near = std::stof(tokens.next());
+            near = parse_float(tokens.next());
         } else if (tok == "far") {
-            far = std::stof(tokens.next());
+            far = parse_float(tokens.next());
         } else if (tok == "left") {
-            left = std::stof(tokens.next());
+            left = parse_float(tokens.next());
         } else if (tok == "right") {
-            right = std::stof(tokens.next());
+            right = parse_float(tokens.next());
         } else if (tok == "top") {
-            top = std::stof(tokens.next());
+            top = parse_float(tokens.next());
         } else if (tok == "bottom") {
-            bottom = std::stof(tokens.next());
+            bottom = parse_float(tokens.next());
         } else if (tok == "light") {
             parse_light(tokens, state);
         } else if (is_section_label(tok)) {
@@ -142,7 +330,7 @@ static void parse_camera(TokenStream& lines, SceneParserState& state)
             lines.rollback(1);
             break;
         } else {
-            throw std::runtime_error("Unrecognised token in camera section " + tok);
+            throw std::runtime_error("Unrecognised token in camera section " + std::string(tok));
         }
     }
 
@@ -160,7 +348,7 @@ static void parse_objects(TokenStream& lines, SceneParserState& state)
 
         if (tokens.done())
             continue;
-        const std::string& tok = tokens.next();
+        std::string_view tok = tokens.next();
 
         if (tok == "t") {
             if (!state.current_object.has_value())
@@ -189,27 +377,26 @@ static void parse_objects(TokenStream& lines, SceneParserState& state)
         } else if (tok == "shininess") {
             if (!state.current_object.has_value())
                 throw std::runtime_error("No instance to apply shininess parameter to");
-            state.current_material.shininess() = std::stof(tokens.next());
+            state.current_material.shininess() = parse_float(tokens.next());
         } else if (tok == "light") {
             parse_light(tokens, state);
+        } else if (tok == "array") {
+            parse_array(tokens, lines, state);
         } else if (is_section_label(tok)) {
             // New section has started, so we exit.
             lines.rollback(1);
             break;
         } else {
-            parse_identifier(tok, tokens, state);
+            // Short identifiers fit in a string without a heap allocation
+            parse_identifier(std::string(tok), tokens, state);
         }
     }
 
     // Since we only add an instance to the scene when it is made no longer
     // relevant by another instance, the last instance won't be added.
     // The following code corrects for that.
-    if (state.current_object.has_value()) {
-        Instance instance(state.mesh_indices[state.current_object.value()],
-                          state.current_transform,
-                          state.current_material);
-        state.instances.push_back(instance);
-    }
+    if (state.current_object.has_value())
+        finish_instance(state);
 }
 
 // Parses on the section level (camera/objects)
@@ -219,18 +406,27 @@ static void parse_sections(TokenStream& lines, SceneParserState& state)
         TokenStream tokens(lines.next(), ' ');
         if (tokens.done())
             continue;
-        const std::string& tok = tokens.next();
+        std::string_view tok = tokens.next();
         if (tok == "camera:") {
             parse_camera(lines, state);
         } else if (tok == "objects:") {
             parse_objects(lines, state);
         } else {
-            throw std::runtime_error("Unrecognised token " + tok);
+            throw std::runtime_error("Unrecognised token " + std::string(tok));
         }
     }
 }
 
 Scene read_scene(const std::string& raw, const std::string& data_dir)
+{
+    MeshCache mesh_cache;
+    return read_scene(raw, data_dir, mesh_cache);
+}
+
+Scene read_scene(const std::string& raw,
+                 const std::string& data_dir,
+                 MeshCache& mesh_cache,
+                 SceneReadReport* report)
 {
     std::string chars_to_remove = "\r\t";
     std::string filtered = raw;
@@ -238,11 +434,41 @@ Scene read_scene(const std::string& raw, const std::string& data_dir)
 
     TokenStream lines(filtered, '\n');
 
-    SceneParserState state(directory_of(data_dir));
+    SceneParserState state(directory_of(data_dir), mesh_cache);
+
+    // The loads refer to the mesh cache, so they are finished before returning
+    // even if parsing fails. A mesh that fails to load takes precedence over a
+    // later parsing error, as it comes first in the file.
+    try {
+        parse_sections(lines, state);
+    } catch (...) {
+        for (auto& load : state.mesh_loads)
+            load->wait();
+        for (auto& load : state.mesh_loads)
+            load->get();
+        throw;
+    }
+
+    for (auto& load : state.mesh_loads)
+        load->wait();
 
-    parse_sections(lines, state);
+    std::vector<std::shared_ptr<const MeshBuffers>> meshes;
+    for (auto& load : state.mesh_loads)
+        meshes.push_back(load->get());
 
     if (!state.camera.has_value())
         throw std::runtime_error("No camera section in scene description");
-    return Scene(state.meshes, state.instances, state.lights, state.camera.value());
+
+    if (report != nullptr) {
+        report->unused_meshes.clear();
+        for (const MeshDeclaration& declaration : state.mesh_declarations) {
+            if (!declaration.mesh_index.has_value())
+                report->unused_meshes.push_back(declaration.identifier);
+        }
+    }
+
+    return Scene(std::move(meshes),
+                 std::move(state.instances),
+                 std::move(state.lights),
+                 state.camera.value());
 }
\ No newline at end of file
@@ -1,7 +1,25 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
+#include "mesh_cache.h"
 #include "scene.h"
 
 Scene read_scene(const std::string& raw, const std::string& data_dir);
+
+// What was found while reading a scene, besides the scene itself
+struct SceneReadReport
+{
+    // Identifiers of the meshes that were declared but never used by an instance,
+    // and therefore never loaded, in the order they were declared
+    std::vector<std::string> unused_meshes;
+};
+
+// Reads a scene like above, but takes its meshes from the given cache so that
+// they are shared with other scenes read through it. Meshes are only loaded if an
+// instance uses them; the others are listed in the report if one is given.
+Scene read_scene(const std::string& raw,
+                 const std::string& data_dir,
+                 MeshCache& mesh_cache,
+                 SceneReadReport* report = nullptr);
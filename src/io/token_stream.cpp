@@ -1,48 +1,77 @@
-#include <cstdio>
-#include <sstream>
+#include <stdexcept>
 
 #include "token_stream.h"
 
-std::vector<std::string> split_string(const std::string& raw, char delimiter)
+size_t TokenStream::skip_delimiters(size_t offset) const
 {
-    std::vector<std::string> res;
-    std::stringstream stream(raw);
-
-    std::string token;
-    while (getline(stream, token, delimiter)) {
-        if (!token.empty())
-            res.push_back(token);
-    }
-
-    return res;
+    while (offset < raw.size() && raw[offset] == delimiter)
+        offset++;
+    return offset;
 }
 
-const std::string& TokenStream::next()
+std::string_view TokenStream::next()
 {
     if (done())
         throw std::runtime_error("Token stream has no next token");
-    return tokens[index++];
+
+    size_t start = skip_delimiters(position);
+    size_t end = raw.find(delimiter, start);
+    position = end == std::string_view::npos ? raw.size() : end;
+    index++;
+    return raw.substr(start, position - start);
 }
 
-const std::string& TokenStream::current() const
+std::string_view TokenStream::current() const
 {
-    return tokens[index];
+    if (done())
+        throw std::runtime_error("Token stream has no current token");
+
+    size_t start = skip_delimiters(position);
+    return raw.substr(start, raw.find(delimiter, start) - start);
 }
 
-const void TokenStream::rollback(size_t amount)
+void TokenStream::rollback(size_t amount)
 {
     if (index < amount)
         throw std::runtime_error("Cannot roll further back than the start");
+
+    // Walks back over the tokens, each of which is preceded by delimiters unless it
+    // starts the string
+    for (size_t i = 0; i < amount; i++) {
+        while (position > 0 && raw[position - 1] == delimiter)
+            position--;
+        while (position > 0 && raw[position - 1] != delimiter)
+            position--;
+    }
     index -= amount;
 }
 
 bool TokenStream::done() const
 {
-    return index >= tokens.size();
+    return skip_delimiters(position) >= raw.size();
 }
 
-TokenStream::TokenStream(const std::string& raw, char delimiter)
+size_t TokenStream::size() const
 {
-    index = 0;
-    tokens = split_string(raw, delimiter);
+    return index + remaining();
 }
+
+size_t TokenStream::remaining() const
+{
+    size_t count = 0;
+    size_t offset = skip_delimiters(position);
+    while (offset < raw.size()) {
+        count++;
+        size_t end = raw.find(delimiter, offset);
+        offset = end == std::string_view::npos ? raw.size() : skip_delimiters(end);
+    }
+    return count;
+}
+
+TokenStream::TokenStream(std::string_view raw, char delimiter)
+    : raw(raw)
+    , delimiter(delimiter)
+    , position(0)
+    , index(0)
+{
+}
\ No newline at end of file
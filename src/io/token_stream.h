@@ -1,25 +1,37 @@
 #pragma once
 
 #include <string>
-#include <vector>
+#include <string_view>
 
 // Deals with tokenising a string and outputing the tokens
-// one-by-one
+// one-by-one. Tokens are views into the string, which the
+// stream borrows and which must outlive it, and are found
+// as they are asked for, so the stream never allocates.
 class TokenStream
 {
   public:
     // Returns current and increments
-    const std::string& next();
-    const std::string& current() const;
-    const void rollback(size_t amount);
+    std::string_view next();
+    std::string_view current() const;
+    void rollback(size_t amount);
     bool done() const;
-    size_t size() const { return tokens.size(); }
+    size_t size() const;
     size_t current_index() const { return index; }
-    size_t remaining() const { return tokens.size() - index; }
+    size_t remaining() const;
 
-    TokenStream(const std::string& raw, char delimiter);
+    TokenStream(std::string_view raw, char delimiter);
+
+    // The tokens would refer to a string that no longer exists
+    TokenStream(std::string&& raw, char delimiter) = delete;
 
   private:
-    std::vector<std::string> tokens;
+    // Start of the first token at or after the given offset, or the end of the
+    // string if there are no more tokens
+    size_t skip_delimiters(size_t offset) const;
+
+    std::string_view raw;
+    char delimiter;
+    // Offset from which the next token is searched for
+    size_t position;
     size_t index;
 };
\ No newline at end of file
@@ -0,0 +1,109 @@
+#include "laplacian.h"
+
+#include <algorithm>
+#include <utility>
+
+CotangentLaplacian::CotangentLaplacian(const HalfedgeMesh& halfedges)
+{
+    size_t n = halfedges.vertex_count();
+    row_offsets.reserve(n + 1);
+    row_offsets.push_back(0);
+    diagonal_entries.resize(n);
+    edge_corner_offsets.push_back(0);
+
+    // Every triangle around vertex i has an edge from i to each of its two other
+    // vertices, and the third corner is opposite to it
+    std::vector<std::pair<uint32_t, uint32_t>> neighbours;
+    for (uint32_t i = 0; i < n; i++) {
+        neighbours.clear();
+        neighbours.emplace_back(i, HalfedgeMesh::none);
+        for (uint32_t k = halfedges.first_outgoing(i); k < halfedges.first_outgoing(i + 1); k++) {
+            uint32_t he = halfedges.outgoing(k);
+            uint32_t next = halfedges.next(he), prev = halfedges.prev(he);
+            neighbours.emplace_back(halfedges.origin(next), prev);
+            neighbours.emplace_back(halfedges.origin(prev), next);
+        }
+        std::sort(neighbours.begin(), neighbours.end());
+
+        for (size_t k = 0; k < neighbours.size(); k++) {
+            uint32_t j = neighbours[k].first;
+            if (k == 0 || neighbours[k - 1].first != j) {
+                if (j == i)
+                    diagonal_entries[i] = columns.size();
+                else if (j > i)
+                    edge_entries.push_back(columns.size());
+                columns.push_back(j);
+            }
+            if (j > i) {
+                edge_corners.push_back(neighbours[k].second);
+                if (k + 1 == neighbours.size() || neighbours[k + 1].first != j)
+                    edge_corner_offsets.push_back(edge_corners.size());
+            }
+        }
+        row_offsets.push_back(columns.size());
+    }
+
+    transposed_entries.resize(columns.size());
+    for (uint32_t i = 0; i < n; i++) {
+        for (int k = row_offsets[i]; k < row_offsets[i + 1]; k++) {
+            int j = columns[k];
+            auto row_begin = columns.begin() + row_offsets[j];
+            auto row_end = columns.begin() + row_offsets[j + 1];
+            transposed_entries[k] = std::lower_bound(row_begin, row_end, (int)i) - columns.begin();
+        }
+    }
+
+    values.resize(columns.size());
+    vertex_areas.resize(n);
+}
+
+void CotangentLaplacian::assemble(const HalfedgeMesh& halfedges, const std::vector<Vec3>& positions, ThreadPool* pool)
+{
+    // The cotangent at every corner, stored by the halfedge going out of it. The
+    // cross product of the two edges at any corner of a face is its normal, which
+    // has twice its area as its length.
+    face_areas.resize(halfedges.face_count());
+    cotangents.resize(3 * halfedges.face_count());
+    parallel_for_chunks(pool, halfedges.face_count(), [&](size_t, size_t begin, size_t end) {
+        for (uint32_t f = begin; f < end; f++) {
+            const Vec3& v1 = positions[halfedges.origin(3 * f)];
+            const Vec3& v2 = positions[halfedges.origin(3 * f + 1)];
+            const Vec3& v3 = positions[halfedges.origin(3 * f + 2)];
+            float normal_length = (v2 - v1).cross(v3 - v1).norm();
+            face_areas[f] = 0.5f * normal_length;
+            for (uint32_t he = 3 * f; he < 3 * f + 3; he++) {
+                const Vec3& corner = positions[halfedges.origin(he)];
+                Vec3 edge_1 = positions[halfedges.origin(halfedges.next(he))] - corner;
+                Vec3 edge_2 = positions[halfedges.origin(halfedges.prev(he))] - corner;
+                cotangents[he] = edge_1.dot(edge_2) / normal_length;
+            }
+        }
+    });
+
+    // Each edge's weight is computed once and written to its two entries, which no
+    // other edge writes to
+    parallel_for_chunks(pool, edge_entries.size(), [&](size_t, size_t begin, size_t end) {
+        for (size_t e = begin; e < end; e++) {
+            float weight = 0.0f;
+            for (uint32_t c = edge_corner_offsets[e]; c < edge_corner_offsets[e + 1]; c++)
+                weight += cotangents[edge_corners[c]];
+            values[edge_entries[e]] = weight;
+            values[transposed_entries[edge_entries[e]]] = weight;
+        }
+    });
+
+    parallel_for_chunks(pool, vertex_count(), [&](size_t, size_t begin, size_t end) {
+        for (uint32_t i = begin; i < end; i++) {
+            float sum = 0.0f;
+            for (int k = row_offsets[i]; k < row_offsets[i + 1]; k++)
+                if (k != diagonal_entries[i])
+                    sum += values[k];
+            values[diagonal_entries[i]] = -sum;
+
+            float area = 0.0f;
+            for (uint32_t k = halfedges.first_outgoing(i); k < halfedges.first_outgoing(i + 1); k++)
+                area += face_areas[halfedges.face(halfedges.outgoing(k))];
+            vertex_areas[i] = area;
+        }
+    });
+}
\ No newline at end of file
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+
+#include "algebra.h"
+#include "halfedge_mesh.h"
+#include "thread_pool.h"
+
+// The cotangent laplacian L of a triangle mesh, in compressed rows, together with
+// the area around every vertex. Off the diagonal, L holds the weight of every
+// edge: the sum of the cotangents of the angles opposite to it, cot(a) + cot(b)
+// between two triangles. Each diagonal entry is minus the sum of the weights in
+// its row. The pattern only depends on the connectivity, so it is built once and
+// only the values are assembled again when the positions change.
+class CotangentLaplacian
+{
+  public:
+    explicit CotangentLaplacian(const HalfedgeMesh& halfedges);
+
+    // Computes the values for the given positions of the vertices of the halfedges
+    // the laplacian was built for. The work is spread over the pool if one is given.
+    void assemble(const HalfedgeMesh& halfedges, const std::vector<Vec3>& positions, ThreadPool* pool = nullptr);
+
+    size_t vertex_count() const { return row_offsets.size() - 1; }
+
+    // The entries of row i, sorted by column and including the diagonal, are those
+    // from row_offsets[i] up to row_offsets[i + 1]. As the pattern is symmetric,
+    // the same arrays describe the columns of L.
+    const std::vector<int>& get_row_offsets() const { return row_offsets; }
+    const std::vector<int>& get_columns() const { return columns; }
+    const std::vector<float>& get_values() const { return values; }
+    // The entry on the diagonal of every row
+    const std::vector<int>& get_diagonal_entries() const { return diagonal_entries; }
+    // The entry (j, i) for every entry (i, j)
+    const std::vector<int>& get_transposed_entries() const { return transposed_entries; }
+
+    // The total area of the triangles around every vertex, which is three times its
+    // lumped (barycentric) mass
+    const std::vector<float>& get_vertex_areas() const { return vertex_areas; }
+
+  private:
+    std::vector<int> row_offsets;
+    std::vector<int> columns;
+    std::vector<float> values;
+    std::vector<int> diagonal_entries;
+    std::vector<int> transposed_entries;
+    std::vector<float> vertex_areas;
+
+    // Every edge, by its entry (i, j) with i < j, and the corners opposite to it,
+    // by the halfedges going out of them. Those of edge e are from
+    // edge_corner_offsets[e] up to edge_corner_offsets[e + 1].
+    std::vector<int> edge_entries;
+    std::vector<uint32_t> edge_corner_offsets;
+    std::vector<uint32_t> edge_corners;
+
+    // Per face and per corner, kept between assemblies to avoid reallocating them
+    std::vector<float> face_areas;
+    std::vector<float> cotangents;
+};
\ No newline at end of file
@@ -1,28 +1,27 @@
 #include <GL/glut.h>
 
+#include <filesystem>
 #include <iostream>
+#include <mutex>
+#include <unistd.h>
 
 #include "animator.h"
+#include "batch_renderer.h"
 #include "ibar.h"
 #include "image.h"
 #include "io/animation_format.h"
+#include "io/batch_format.h"
+#include "io/binary_mesh_format.h"
+#include "io/image_format.h"
 #include "io/ioutil.h"
 #include "io/obj_format.h"
 #include "io/scene_format.h"
 #include "opengl_renderer.h"
-#include "phong_shader.h"
 #include "quaternion.h"
+#include "render_server.h"
 #include "shader_program.h"
 #include "texture2d.h"
-#include "triangle_renderer.h"
-#include "wireframe_renderer.h"
-
-enum class SoftwareRenderMode
-{
-    Wireframe,
-    Gouraud,
-    Phong
-};
+#include "thread_pool.h"
 
 enum class HardwareRenderMode
 {
@@ -35,6 +34,8 @@ static OpenGlRenderer gl_renderer;
 
 static Scene current_scene;
 
+static FairingSolver fairing_solver = FairingSolver::Automatic;
+
 static Quaternion current_arcball_rotation;
 
 struct MouseState
@@ -100,15 +101,18 @@ static Scene quad_scene()
     };
     std::vector<IndexedTriangle> tris = { { 0, 2, 1 }, { 2, 3, 1 } };
 
-    std::vector<MeshBuffers> bufs = { MeshBuffers("quad", Mesh(positions, normals, tris)) };
-    std::vector<Instance> instances = { Instance(0,
-                                                 translation(Vec3(-0.5f, -0.5f, 0.0f)),
-                                                 PhongMaterial(Colour(0.15f), Colour(0.7f), Colour(0.2f), 5.0f)) };
+    std::vector<std::shared_ptr<const MeshBuffers>> bufs = {
+        std::make_shared<const MeshBuffers>("quad", Mesh(positions, normals, tris))
+    };
+    InstanceArray instances;
+    instances.add(0,
+                  translation(Vec3(-0.5f, -0.5f, 0.0f)),
+                  PhongMaterial(Colour(0.15f), Colour(0.7f), Colour(0.2f), 5.0f));
     std::vector<PointLight> lights = { PointLight(Vec3(-3.0f, 4.0f, 4.0f), Colour(1.0f), 0.0f) };
     Camera cam(translation(Vec3(0.0f, 0.0f, 4.0f)),
                rotation(Vec3(0.0f, 1.0f, 0.0f), 0.0f),
                projection(3.0f, 10.0f, -0.5f, 0.5f, 0.5f, -0.5f));
-    return Scene(bufs, instances, lights, cam);
+    return Scene(std::move(bufs), std::move(instances), std::move(lights), cam);
 }
 
 static Vec3 point_on_arcball(float ndc_x, float ndc_y)
@@ -179,9 +183,20 @@ static void key_pressed(unsigned char key, int x, int y)
         float smooth_amount = 0.001f * (1 << (key - '0'));
         std::cout << "Smoothing by " << smooth_amount << "..." << std::endl;
 
+        // Used by the conjugate gradient solver
+        static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+
+        // Meshes are immutable, so each one is replaced by a smoothed copy. One
+        // that fails to smooth is kept as it is.
         for (auto& scene_mesh : current_scene.get_meshes()) {
-            scene_mesh.get_mesh().implicit_fairing(smooth_amount);
-            scene_mesh.update_buffers();
+            Mesh mesh = scene_mesh->get_mesh();
+            try {
+                mesh.implicit_fairing(smooth_amount, fairing_solver, &pool);
+            } catch (const std::exception& e) {
+                std::cerr << scene_mesh->get_identifier() << ": " << e.what() << '\n';
+                continue;
+            }
+            scene_mesh = std::make_shared<const MeshBuffers>(scene_mesh->get_identifier(), std::move(mesh));
         }
         std::cout << "Done." << std::endl;
         glutPostRedisplay();
@@ -270,7 +285,7 @@ static void start_opengl_renderer(const std::string& scene_path, HardwareRenderM
 
 static void parse_opengl_renderer(int argc, char** argv)
 {
-    if (argc == 4) {
+    if (argc == 4 || argc == 5) {
 
         std::string scene_path(argv[2]);
         std::string mode_str(argv[3]);
@@ -284,37 +299,61 @@ static void parse_opengl_renderer(int argc, char** argv)
             std::cout << "Mode was not gouraud, phong, or wireframe." << std::endl;
         }
 
+        if (argc == 5) {
+            std::string solver_str(argv[4]);
+            if (solver_str == "lu") {
+                fairing_solver = FairingSolver::Lu;
+            } else if (solver_str == "ldlt") {
+                fairing_solver = FairingSolver::Ldlt;
+            } else if (solver_str == "cg") {
+                fairing_solver = FairingSolver::ConjugateGradient;
+            } else if (solver_str != "auto") {
+                std::cout << "Solver was not auto, lu, ldlt, or cg." << std::endl;
+                return;
+            }
+        }
+
         init_glut(argc, argv);
 
         start_opengl_renderer(scene_path, mode);
 
     } else {
         std::cout << "Invalid argument count. Usage is:\n"
-                  << "opengl SCENE_PATH gouraud|phong" << std::endl;
+                  << "opengl SCENE_PATH gouraud|phong [SOLVER]" << std::endl;
     }
 }
 
-void start_software_renderer(const std::string& scene_path, int width, int height, SoftwareRenderMode mode)
+void start_software_renderer(const std::string& scene_path,
+                             int width,
+                             int height,
+                             SoftwareRenderMode mode,
+                             int thread_count,
+                             ImageFormat format)
 {
-    Scene scene = read_scene(str_from_file(scene_path), directory_of(scene_path));
+    // The rendering thread takes part in the work, so it counts as one of the threads
+    ThreadPool pool(thread_count - 1);
+
+    MeshCache mesh_cache(0, &pool);
+    SceneReadReport report;
+    Scene scene = read_scene(str_from_file(scene_path), directory_of(scene_path), mesh_cache, &report);
+
+    // The image goes to stdout, so the report goes to stderr
+    if (!report.unused_meshes.empty()) {
+        std::cerr << "Meshes declared but not used:";
+        for (const std::string& identifier : report.unused_meshes)
+            std::cerr << ' ' << identifier;
+        std::cerr << std::endl;
+    }
 
     Image image(width, height);
+    render_software(scene, image, mode, pool);
 
-    if (mode == SoftwareRenderMode::Wireframe) {
-        WireframeRenderer renderer;
-        renderer.render(image, scene);
-    } else {
-        TriangleRenderer renderer;
-        PhongShader shader(mode == SoftwareRenderMode::Phong);
-        renderer.render(&shader, image, scene);
-    }
-
-    std::cout << image.to_ppm() << std::endl;
+    write_image(image, format, STDOUT_FILENO);
 }
 
 static void parse_software_renderer(int argc, char** argv)
 {
-    if (argc == 6) {
+    if (argc >= 6 && argc <= 8) {
         std::string scene_path(argv[2]);
         std::string width_str(argv[3]);
         int width, height;
@@ -328,13 +367,35 @@ static void parse_software_renderer(int argc, char** argv)
                     mode = SoftwareRenderMode::Gouraud;
                 } else if (mode_str == "phong") {
                     mode = SoftwareRenderMode::Phong;
+                } else if (mode_str == "deferred") {
+                    mode = SoftwareRenderMode::DeferredPhong;
                 } else if (mode_str == "wireframe") {
                     mode = SoftwareRenderMode::Wireframe;
                 } else {
-                    std::cout << "Mode was not gouraud, phong, or wireframe." << std::endl;
+                    std::cout << "Mode was not gouraud, phong, deferred, or wireframe." << std::endl;
+                }
+                int thread_count = std::max(1u, std::thread::hardware_concurrency());
+                if (argc >= 7) {
+                    std::string threads_str(argv[6]);
+                    if (!is_uinteger(threads_str) || (thread_count = std::stoi(threads_str)) <= 0) {
+                        std::cout << "Thread count was not a positive integer." << std::endl;
+                        return;
+                    }
+                }
+                ImageFormat format = ImageFormat::Ppm;
+                if (argc == 8) {
+                    std::string format_str(argv[7]);
+                    if (format_str == "pfm") {
+                        format = ImageFormat::Pfm;
+                    } else if (format_str == "qoi") {
+                        format = ImageFormat::Qoi;
+                    } else if (format_str != "ppm") {
+                        std::cout << "Format was not ppm, pfm, or qoi." << std::endl;
+                        return;
+                    }
                 }
                 try {
-                    start_software_renderer(scene_path, width, height, mode);
+                    start_software_renderer(scene_path, width, height, mode, thread_count, format);
                 } catch (const std::exception& e) {
                     std::cerr << e.what() << '\n';
                 }
@@ -346,7 +407,125 @@ static void parse_software_renderer(int argc, char** argv)
         }
     } else {
         std::cout << "Invalid argument count. Usage is:\n"
-                  << "software SCENE_PATH WIDTH HEIGHT gouraud|phong|wireframe" << std::endl;
+                  << "software SCENE_PATH WIDTH HEIGHT gouraud|phong|deferred|wireframe [THREADS [FORMAT]]"
+                  << std::endl;
+    }
+}
+
+static void start_batch_renderer(const std::string& manifest_path, int thread_count)
+{
+    std::vector<BatchJob> jobs = read_batch(str_from_file(manifest_path), directory_of(manifest_path));
+
+    ThreadPool pool(thread_count - 1);
+    size_t failed = run_batch(jobs, pool, std::cerr);
+
+    std::cout << "Rendered " << jobs.size() - failed << " of " << jobs.size() << " jobs." << std::endl;
+}
+
+static void parse_batch_renderer(int argc, char** argv)
+{
+    if (argc == 3 || argc == 4) {
+        std::string manifest_path(argv[2]);
+        int thread_count = std::max(1u, std::thread::hardware_concurrency());
+        if (argc == 4) {
+            std::string threads_str(argv[3]);
+            if (!is_uinteger(threads_str) || (thread_count = std::stoi(threads_str)) <= 0) {
+                std::cout << "Thread count was not a positive integer." << std::endl;
+                return;
+            }
+        }
+        try {
+            start_batch_renderer(manifest_path, thread_count);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << '\n';
+        }
+    } else {
+        std::cout << "Invalid argument count. Usage is:\n"
+                  << "batch MANIFEST_PATH [THREADS]" << std::endl;
+    }
+}
+
+static void start_render_server(const std::string& socket_path, int thread_count)
+{
+    ThreadPool pool(thread_count - 1);
+    RenderServer server(socket_path, pool);
+
+    std::cout << "Serving on " << socket_path << std::endl;
+    server.run();
+}
+
+static void parse_render_server(int argc, char** argv)
+{
+    if (argc == 3 || argc == 4) {
+        std::string socket_path(argv[2]);
+        int thread_count = std::max(1u, std::thread::hardware_concurrency());
+        if (argc == 4) {
+            std::string threads_str(argv[3]);
+            if (!is_uinteger(threads_str) || (thread_count = std::stoi(threads_str)) <= 0) {
+                std::cout << "Thread count was not a positive integer." << std::endl;
+                return;
+            }
+        }
+        try {
+            start_render_server(socket_path, thread_count);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << '\n';
+        }
+    } else {
+        std::cout << "Invalid argument count. Usage is:\n"
+                  << "serve SOCKET_PATH [THREADS]" << std::endl;
+    }
+}
+
+static void start_mesh_converter(const std::vector<std::string>& paths)
+{
+    // Directories are searched for obj files, while files are converted as given
+    std::vector<std::string> obj_paths;
+    for (const std::string& path : paths) {
+        if (std::filesystem::is_directory(path)) {
+            for (const auto& entry : std::filesystem::recursive_directory_iterator(path)) {
+                if (entry.is_regular_file() && entry.path().extension() == ".obj")
+                    obj_paths.push_back(entry.path().string());
+            }
+        } else {
+            obj_paths.push_back(path);
+        }
+    }
+
+    ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    std::mutex log_mutex;
+    std::atomic<size_t> converted(0), failed(0);
+
+    pool.parallel_for(obj_paths.size(), [&](size_t i) {
+        const std::string& path = obj_paths[i];
+        if (binary_mesh_up_to_date(path))
+            return;
+        try {
+            write_binary_mesh(read_obj_file(path, &pool), binary_mesh_path(path));
+            converted++;
+        } catch (const std::exception& e) {
+            std::lock_guard<std::mutex> lock(log_mutex);
+            std::cerr << path << ": " << e.what() << '\n';
+            failed++;
+        }
+    });
+
+    std::cout << "Converted " << converted << " of " << obj_paths.size() << " meshes ("
+              << obj_paths.size() - converted - failed << " up to date, " << failed << " failed)." << std::endl;
+}
+
+static void parse_mesh_converter(int argc, char** argv)
+{
+    if (argc >= 3) {
+        std::vector<std::string> paths(argv + 2, argv + argc);
+        try {
+            start_mesh_converter(paths);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << '\n';
+        }
+    } else {
+        std::cout << "Invalid argument count. Usage is:\n"
+                  << "convert PATH..." << std::endl;
     }
 }
 
@@ -418,15 +597,40 @@ int main(int argc, char** argv)
             parse_opengl_renderer(argc, argv);
         } else if (arg == "software") {
             parse_software_renderer(argc, argv);
+        } else if (arg == "batch") {
+            parse_batch_renderer(argc, argv);
+        } else if (arg == "serve") {
+            parse_render_server(argc, argv);
+        } else if (arg == "convert") {
+            parse_mesh_converter(argc, argv);
         } else if (arg == "texture") {
             parse_texturing_demo(argc, argv);
         } else if (arg == "help") {
             std::cout << "Usage:\n"
-                      << "opengl SCENE_PATH\n"
+                      << "opengl SCENE_PATH gouraud|phong [SOLVER]\n"
                       << "  * Renders an interactive scene using OpenGL. The number keys may\n"
-                      << "    be pressed to smooth the meshes in the scene.\n"
-                      << "software SCENE_PATH WIDTH HEIGHT gouraud|phong|wireframe\n"
-                      << "  * Renders the scene using the CPU (ppm format to stdout).\n"
+                      << "    be pressed to smooth the meshes in the scene. SOLVER is how the\n"
+                      << "    smoothing is computed: ldlt (sparse Cholesky), cg (conjugate\n"
+                      << "    gradients), lu (sparse LU) or auto (the default, ldlt for small\n"
+                      << "    meshes and cg for large ones).\n"
+                      << "software SCENE_PATH WIDTH HEIGHT gouraud|phong|deferred|wireframe [THREADS [FORMAT]]\n"
+                      << "  * Renders the scene using the CPU and writes the image to stdout.\n"
+                      << "    The deferred mode is Phong shading that shades each visible pixel\n"
+                      << "    once. THREADS defaults to the number of hardware threads. FORMAT\n"
+                      << "    is ppm (binary, the default), pfm (floating point) or qoi.\n"
+                      << "batch MANIFEST_PATH [THREADS]\n"
+                      << "  * Renders every job in the manifest with the software renderer,\n"
+                      << "    several at a time, loading each scene and mesh only once.\n"
+                      << "    See io/batch_format.h for the manifest format.\n"
+                      << "serve SOCKET_PATH [THREADS]\n"
+                      << "  * Renders jobs sent to a Unix domain socket with the software\n"
+                      << "    renderer, keeping meshes loaded between them. See\n"
+                      << "    render_server.h for the protocol.\n"
+                      << "convert PATH...\n"
+                      << "  * Writes the binary version of every obj file given, or found in\n"
+                      << "    the directories given, unless it is already up to date. Scenes\n"
+                      << "    load the binary version of a mesh when it is newer than the obj\n"
+                      << "    file, and otherwise write it the first time they load the mesh.\n"
                       << "texture DIFFUSE_MAP_PATH NORMAL_MAP_PATH\n"
                       << "  * Starts an interactive demo scene of normal mapping." << std::endl;
         }
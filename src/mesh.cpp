@@ -1,211 +1,328 @@
 #include "mesh.h"
 
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+
+#if defined(__SSE2__)
+#include <pmmintrin.h>
+#endif
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wignored-attributes"
 #include <Eigen/Dense>
 #include <Eigen/Sparse>
 #pragma GCC diagnostic pop
 
-#include <halfedge.h>
-#include <structs.h>
-
-// Converts the Mesh class into the halfedge compatible struct
-static HeMesh_Data to_mesh_data(const Mesh& mesh)
-{
-    HeMesh_Data mesh_data;
-    auto& he_vertices = mesh_data.vertices;
-    he_vertices.reserve(mesh.get_vertex_positions().size());
-    for (int i = 0; i < mesh.get_vertex_positions().size(); i++)
-        he_vertices.push_back((HeVertex*)&mesh.get_vertex_positions()[i]);
-
-    auto& he_faces = mesh_data.faces;
-    he_faces.reserve(mesh.get_indexed_triangles().size());
-    for (int i = 0; i < mesh.get_indexed_triangles().size(); i++)
-        he_faces.push_back((HeFace*)&mesh.get_indexed_triangles()[i]);
-
-    return mesh_data;
-}
+#include "conjugate_gradient.h"
+#include "halfedge_mesh.h"
+#include "laplacian.h"
 
-// Calculates new normals based on the area-weighted normal approach
-void Mesh::recalculate_normals()
+struct FairingCache
 {
-    std::vector<HEV*> hevs;
-    std::vector<HEF*> hefs;
-    auto mesh_data = to_mesh_data(*this);
-
-    build_HE(&mesh_data, &hevs, &hefs);
-
-    vertex_normals.clear();
-    vertex_normals.reserve(vertex_positions.size());
+    explicit FairingCache(const HalfedgeMesh& halfedges)
+        : laplacian(halfedges)
+    {
+    }
 
-    // For each vertex in each triangle, we calculate the new normal
-    for (int i = 0; i < tris.size(); i++) {
-        for (int j = 0; j < 3; j++) {
+    CotangentLaplacian laplacian;
 
-            const auto& v = hevs[tris[i].position_indices[j]];
-            Vec3 normal = Vec3::Zero();
+    // The matrix of the system for the solver in use, of which only the sparsity
+    // pattern is fixed: that of the laplacian, for all solvers. Being symmetric,
+    // the pattern is stored by column in the same arrays as the laplacian's rows,
+    // so entry (i, j) of the system has the index of entry (j, i) of the laplacian.
+    Eigen::SparseMatrix<float> system;
 
-            // Traverse the neighboring vertices using the halfedge data structure
-            HE* he = v->out;
-            do {
-                HEF* f = he->face;
+    // The right hand side of the symmetric system, which only depends on what the
+    // system was filled in for
+    RowVectors3 right_hand_side;
 
-                HEV* v1 = f->edge->vertex;
-                HEV* v2 = f->edge->next->vertex;
-                HEV* v3 = f->edge->next->next->vertex;
+    // Copies of a mesh share the cache, so the system and solvers are guarded
+    std::mutex solver_mutex;
 
-                Vec3 face_normal = Vec3(v2->x - v1->x, v2->y - v1->y, v2->z - v1->z)
-                                       .cross(Vec3(v3->x - v1->x, v3->y - v1->y, v3->z - v1->z));
-                float area = 0.5f * face_normal.norm();
-                normal += face_normal * area;
+    // The solvers analyse the sparsity pattern the first time they are used
+    Eigen::SparseLU<Eigen::SparseMatrix<float>> lu;
+    bool lu_analysed = false;
+    Eigen::SimplicialLDLT<Eigen::SparseMatrix<float>> ldlt;
+    bool ldlt_analysed = false;
 
-                he = he->flip->next;
-            } while (he != v->out);
+    // What the system was last filled in (and factorized) for
+    bool filled = false;
+    FairingSolver filled_solver = FairingSolver::Automatic;
+    uint64_t filled_version = 0;
+    float filled_h = 0.0f;
+};
 
-            // Set the new normal
-            tris[i].normal_indices[j] = vertex_normals.size();
-            vertex_normals.push_back(normal.normalized());
-        }
-    }
+uint64_t Mesh::new_geometry_version()
+{
+    static std::atomic<uint64_t> next_version(1);
+    return next_version++;
 }
 
-// Calculates 1/(2A) for each vertex based on the surrounding triangles. The given
-// float buffer will be populated with the values with the value at index i corresponding
-// to the value of vertex i.
-static void get_half_inverse_areas(const std::vector<HEV*>& hevs, float* half_inv_areas)
+const HalfedgeMesh& Mesh::get_halfedges()
 {
-    for (const auto& v_i : hevs) {
-        half_inv_areas[v_i->index] = 0.0f;
-        HE* he = v_i->out;
+    if (!halfedges)
+        halfedges = std::make_shared<const HalfedgeMesh>(tris, vertex_positions.size());
+    return *halfedges;
+}
 
-        do {
-            HEF* f = he->face;
+// Builds the laplacian and the sparsity pattern of the fairing system
+static std::shared_ptr<FairingCache> build_fairing_cache(const HalfedgeMesh& halfedges)
+{
+    auto cache = std::make_shared<FairingCache>(halfedges);
+    const CotangentLaplacian& laplacian = cache->laplacian;
+    const std::vector<int>& offsets = laplacian.get_row_offsets();
+    const std::vector<int>& columns = laplacian.get_columns();
+
+    auto& system = cache->system;
+    system.resize(laplacian.vertex_count(), laplacian.vertex_count());
+    system.resizeNonZeros(columns.size());
+    std::copy(offsets.begin(), offsets.end(), system.outerIndexPtr());
+    std::copy(columns.begin(), columns.end(), system.innerIndexPtr());
+
+    return cache;
+}
 
-            HEV* v1 = f->edge->vertex;
-            HEV* v2 = f->edge->next->vertex;
-            HEV* v3 = f->edge->next->next->vertex;
+FairingCache& Mesh::get_fairing_cache()
+{
+    if (!fairing_cache)
+        fairing_cache = build_fairing_cache(get_halfedges());
+    return *fairing_cache;
+}
 
-            Vec3 face_normal = Vec3(v2->x - v1->x, v2->y - v1->y, v2->z - v1->z)
-                                   .cross(Vec3(v3->x - v1->x, v3->y - v1->y, v3->z - v1->z));
-            half_inv_areas[v_i->index] += 0.5f * face_normal.norm();
+// Calculates the (unnormalised) normal of every face, which has twice the area of
+// the face as its length
+static std::vector<Vec3> face_normals(const HalfedgeMesh& halfedges,
+                                      const std::vector<Vec3>& positions,
+                                      ThreadPool* pool)
+{
+    std::vector<Vec3> normals(halfedges.face_count());
+    parallel_for_chunks(pool, normals.size(), [&](size_t, size_t begin, size_t end) {
+        for (uint32_t f = begin; f < end; f++) {
+            const Vec3& v1 = positions[halfedges.origin(3 * f)];
+            const Vec3& v2 = positions[halfedges.origin(3 * f + 1)];
+            const Vec3& v3 = positions[halfedges.origin(3 * f + 2)];
+            normals[f] = (v2 - v1).cross(v3 - v1);
+        }
+    });
+    return normals;
+}
 
-            he = he->flip->next;
-        } while (he != v_i->out);
+// Calculates new normals based on the area-weighted normal approach
+void Mesh::recalculate_normals(ThreadPool* pool)
+{
+    const HalfedgeMesh& halfedges = get_halfedges();
+
+    // Weighted by area once more, so that the normal of a face counts with the
+    // square of its area
+    std::vector<Vec3> weighted_normals = face_normals(halfedges, vertex_positions, pool);
+    parallel_for_chunks(pool, weighted_normals.size(), [&](size_t, size_t begin, size_t end) {
+        for (size_t f = begin; f < end; f++)
+            weighted_normals[f] *= 0.5f * weighted_normals[f].norm();
+    });
+
+    // Every vertex gathers the normals of the faces around it, so that each normal
+    // is written by one thread only
+    vertex_normals.resize(vertex_positions.size());
+    parallel_for_chunks(pool, vertex_positions.size(), [&](size_t, size_t begin, size_t end) {
+        for (uint32_t v = begin; v < end; v++) {
+            Vec3 normal = Vec3::Zero();
+            for (uint32_t k = halfedges.first_outgoing(v); k < halfedges.first_outgoing(v + 1); k++)
+                normal += weighted_normals[halfedges.face(halfedges.outgoing(k))];
+            vertex_normals[v] = normal.normalized();
+        }
+    });
 
-        if (half_inv_areas[v_i->index] < 1e-5)
-            half_inv_areas[v_i->index] = 0.0f;
-        else
-            half_inv_areas[v_i->index] = 1.0f / (2.0f * half_inv_areas[v_i->index]);
-    }
+    for (IndexedTriangle& tri : tris)
+        for (int i = 0; i < 3; i++)
+            tri.normal_indices[i] = tri.position_indices[i];
 }
 
-// Builds the coefficient matrix corresponding to the discrete laplacian for all vertices
-static Eigen::SparseMatrix<float> build_discrete_laplacian(
-    const std::vector<HEV*>& hevs,
-    float* half_inv_areas)
+// Fills in the values of the system for the given positions, where the
+// laplacian is discretised with the cotangent formula. The system is either
+// I - h * M^-1 * L (as for the Lu solver) or the symmetric M - h * L, in which case
+// its right hand side is filled in as well. Vertices surrounded by (nearly) no
+// area are kept where they are. The work is spread over the pool if one is given.
+static void fill_fairing_system(FairingCache& cache,
+                                const HalfedgeMesh& halfedges,
+                                const std::vector<Vec3>& positions,
+                                float h,
+                                bool symmetric,
+                                ThreadPool* pool)
 {
-    Eigen::SparseMatrix<float> delta(hevs.size(), hevs.size());
-    delta.reserve(Eigen::VectorXi::Constant(hevs.size(), 7));
-
-    for (const auto& v_i : hevs) {
-
-        delta.insert(v_i->index, v_i->index) = 0;
-
-        // Traverse each surrounding vertex of v_i and find cot(a_j) and cot(b_j) to insert
-        // into the matrix.
-        HE* he = v_i->out;
-        do {
-            HEV* v_j = he->next->vertex;
-
-            Vec3 v_i_pos = Vec3(v_i->x, v_i->y, v_i->z);
-            Vec3 v_j_pos = Vec3(v_j->x, v_j->y, v_j->z);
-
-            // Calculate cot(a_j)
-            float cot_a;
-            {
-                HEV* v_a = he->flip->next->next->vertex;
-                Vec3 v_a_pos = Vec3(v_a->x, v_a->y, v_a->z);
-                Vec3 a1_vec = v_i_pos - v_a_pos;
-                Vec3 a2_vec = v_j_pos - v_a_pos;
-                cot_a = a1_vec.dot(a2_vec) / a1_vec.cross(a2_vec).norm();
+    CotangentLaplacian& laplacian = cache.laplacian;
+    laplacian.assemble(halfedges, positions, pool);
+
+    const std::vector<int>& offsets = laplacian.get_row_offsets();
+    const std::vector<int>& columns = laplacian.get_columns();
+    const std::vector<float>& weights = laplacian.get_values();
+    const std::vector<int>& diagonal_entries = laplacian.get_diagonal_entries();
+    const std::vector<int>& transposed_entries = laplacian.get_transposed_entries();
+    const std::vector<float>& areas = laplacian.get_vertex_areas();
+    float* values = cache.system.valuePtr();
+    size_t n = positions.size();
+
+    auto is_fixed = [&](size_t i) { return areas[i] < 1e-5; };
+
+    if (symmetric)
+        cache.right_hand_side.resize(n, 3);
+
+    // Every row writes its own entries and row of the right hand side only
+    parallel_for_chunks(pool, n, [&](size_t, size_t begin, size_t end) {
+        for (uint32_t i = begin; i < end; i++) {
+            int row_begin = offsets[i], row_end = offsets[i + 1];
+
+            // The laplacian is (1/(2A)) * L, so in the symmetric system the mass is
+            // 2A. A fixed vertex has a row of zeros in the laplacian, and in the
+            // symmetric system its column is moved to the right hand side as well.
+            float half_inv_area;
+            if (symmetric) {
+                if (is_fixed(i)) {
+                    for (int k = row_begin; k < row_end; k++)
+                        values[transposed_entries[k]] = k == diagonal_entries[i] ? 1.0f : 0.0f;
+                    cache.right_hand_side.row(i) = positions[i].transpose();
+                    continue;
+                }
+                half_inv_area = 1.0f;
+                cache.right_hand_side.row(i) = 2.0f * areas[i] * positions[i].transpose();
+            } else if (is_fixed(i)) {
+                half_inv_area = 0.0f;
+            } else {
+                half_inv_area = 1.0f / (2.0f * areas[i]);
             }
 
-            // Calculate cot(b_j)
-            float cot_b;
-            {
-                HEV* v_b = he->next->next->vertex;
-                Vec3 v_b_pos = Vec3(v_b->x, v_b->y, v_b->z);
-                Vec3 b1_vec = v_i_pos - v_b_pos;
-                Vec3 b2_vec = v_j_pos - v_b_pos;
-                cot_b = b1_vec.dot(b2_vec) / b1_vec.cross(b2_vec).norm();
+            for (int k = row_begin; k < row_end; k++) {
+                float value;
+                if (k == diagonal_entries[i]) {
+                    value = (symmetric ? 2.0f * areas[i] : 1.0f) - h * (weights[k] * half_inv_area);
+                } else {
+                    value = -(h * (weights[k] * half_inv_area));
+                    if (symmetric && is_fixed(columns[k])) {
+                        cache.right_hand_side.row(i) -= value * positions[columns[k]].transpose();
+                        value = 0.0f;
+                    }
+                }
+                values[transposed_entries[k]] = value;
             }
-
-            // Update values in matrix
-            delta.coeffRef(v_i->index, v_i->index) += (-cot_a - cot_b) * half_inv_areas[v_i->index];
-            delta.insert(v_i->index, v_j->index) = (cot_a + cot_b) * half_inv_areas[v_i->index];
-
-            he = he->flip->next;
-        } while (he != v_i->out);
-    }
-
-    return delta;
+        }
+    });
 }
 
-void Mesh::implicit_fairing(float h)
+// Treats denormal floats as zero on this thread while it exists. When h is small,
+// the entries of a factorization fall off quickly away from the diagonal, and
+// computing with the many that become denormal is slower by an order of magnitude
+// while making no visible difference.
+class FlushDenormals
 {
-    std::vector<HEV*> hevs;
-    std::vector<HEF*> hefs;
-    auto mesh_data = to_mesh_data(*this);
-
-    build_HE(&mesh_data, &hevs, &hefs);
-
-    // Set the indices for the vertices in the halfedge data structure
-    for (int i = 0; i < hevs.size(); i++)
-        hevs[i]->index = i;
-
-    float* half_inv_areas = new float[hevs.size()];
-
-    get_half_inverse_areas(hevs, half_inv_areas);
-
-    auto delta = build_discrete_laplacian(hevs, half_inv_areas);
-
-    delete[] half_inv_areas;
+  public:
+    FlushDenormals()
+    {
+#if defined(__SSE2__)
+        saved_mode = _mm_getcsr();
+        _mm_setcsr(saved_mode | _MM_FLUSH_ZERO_ON | _MM_DENORMALS_ZERO_ON);
+#endif
+    }
 
-    Eigen::SparseMatrix<float> ident(hevs.size(), hevs.size());
-    ident.setIdentity();
+    ~FlushDenormals()
+    {
+#if defined(__SSE2__)
+        _mm_setcsr(saved_mode);
+#endif
+    }
 
-    auto f = ident - h * delta;
+    FlushDenormals(FlushDenormals const&) = delete;
+    void operator=(FlushDenormals const&) = delete;
 
-    // op.makeCompressed();
+  private:
+    unsigned int saved_mode;
+};
 
-    Eigen::SparseLU<Eigen::SparseMatrix<float>> solver;
+// Meshes up to this many vertices are smoothed with the Ldlt solver when the
+// solver is chosen automatically. Beyond it, the fill-in of the factorization
+// makes conjugate gradients faster.
+static constexpr size_t automatic_ldlt_vertex_limit = 50000;
 
-    solver.analyzePattern(f);
-    solver.factorize(f);
+void Mesh::implicit_fairing(float h, FairingSolver solver, ThreadPool* pool)
+{
+    FairingCache& cache = get_fairing_cache();
+    size_t n = vertex_positions.size();
+
+    if (solver == FairingSolver::Automatic)
+        solver = n <= automatic_ldlt_vertex_limit ? FairingSolver::Ldlt : FairingSolver::ConjugateGradient;
+    bool symmetric = solver != FairingSolver::Lu;
+
+    // The positions, one vertex per row, are the right hand side of the equation
+    static_assert(sizeof(Vec3) == 3 * sizeof(float), "Vec3 must be three packed floats");
+    Eigen::Map<RowVectors3> positions((float*)vertex_positions.data(), n, 3);
+
+    // Solve, factorizing the system only if it is not already for these
+    // positions, time step and solver
+    {
+        std::lock_guard<std::mutex> lock(cache.solver_mutex);
+        FlushDenormals flush_denormals;
+
+        // A system that fails to factorize or solve is not used again
+        auto fail = [&](const char* message) {
+            cache.filled = false;
+            throw std::runtime_error(message);
+        };
+
+        if (!cache.filled || cache.filled_solver != solver ||
+            cache.filled_version != geometry_version || cache.filled_h != h) {
+            cache.filled = false;
+            fill_fairing_system(cache, get_halfedges(), vertex_positions, h, symmetric, pool);
+
+            if (solver == FairingSolver::Lu) {
+                if (!cache.lu_analysed)
+                    cache.lu.analyzePattern(cache.system);
+                cache.lu_analysed = true;
+                cache.lu.factorize(cache.system);
+                if (cache.lu.info() != Eigen::Success)
+                    fail("The fairing system could not be factorized");
+            } else if (solver == FairingSolver::Ldlt) {
+                if (!cache.ldlt_analysed)
+                    cache.ldlt.analyzePattern(cache.system);
+                cache.ldlt_analysed = true;
+                cache.ldlt.factorize(cache.system);
+                if (cache.ldlt.info() != Eigen::Success)
+                    fail("The fairing system could not be factorized");
+            }
 
-    // Create right hand side of the equation
-    Eigen::VectorXf x_0(hevs.size()), y_0(hevs.size()), z_0(hevs.size());
-    for (int i = 0; i < hevs.size(); i++) {
-        x_0[i] = vertex_positions[i].x();
-        y_0[i] = vertex_positions[i].y();
-        z_0[i] = vertex_positions[i].z();
-    }
+            cache.filled = true;
+            cache.filled_solver = solver;
+            cache.filled_version = geometry_version;
+            cache.filled_h = h;
+        }
 
-    // Solve
-    Eigen::VectorXf x_h(hevs.size()), y_h(hevs.size()), z_h(hevs.size());
-    x_h = solver.solve(x_0);
-    y_h = solver.solve(y_0);
-    z_h = solver.solve(z_0);
-
-    // Update vertex positions
-    for (int i = 0; i < vertex_positions.size(); i++) {
-        auto& v = vertex_positions[i];
-        v.x() = x_h[i];
-        v.y() = y_h[i];
-        v.z() = z_h[i];
+        // All three coordinates are solved for at once. The positions are only
+        // replaced once the solve has succeeded, so that a failure leaves them as
+        // they were.
+        if (solver == FairingSolver::Lu) {
+            Eigen::MatrixXf x_0 = positions;
+            Eigen::MatrixXf x_h = cache.lu.solve(x_0);
+            if (cache.lu.info() != Eigen::Success || !x_h.allFinite())
+                fail("The fairing system could not be solved");
+            positions = x_h;
+        } else {
+            const RowVectors3& b = cache.right_hand_side;
+            if (solver == FairingSolver::Ldlt) {
+                Eigen::MatrixXf x_h = cache.ldlt.solve(Eigen::MatrixXf(b));
+                if (cache.ldlt.info() != Eigen::Success || !x_h.allFinite())
+                    fail("The fairing system could not be solved");
+                positions = x_h;
+            } else {
+                // Starting from the current positions, which the solution is close to
+                RowVectors3 x = positions;
+                if (!solve_conjugate_gradient(cache.system, b, x, 1e-6f, 1000, pool))
+                    fail("Conjugate gradients did not converge on the fairing system");
+                positions = x;
+            }
+        }
     }
+    geometry_version = new_geometry_version();
 
-    recalculate_normals();
+    recalculate_normals(pool);
 }
 
 std::vector<OwnedTriangle> Mesh::owned_triangles() const
@@ -225,7 +342,10 @@ std::vector<OwnedTriangle> Mesh::owned_triangles() const
 
 void Mesh::create_buffers(std::vector<Vec3>& positions, std::vector<Vec3>& normals) const
 {
-    for (auto tri : tris) {
+    positions.reserve(positions.size() + 3 * tris.size());
+    normals.reserve(normals.size() + 3 * tris.size());
+
+    for (const auto& tri : tris) {
         for (int i = 0; i < 3; i++) {
             positions.push_back(vertex_positions[tri.position_indices[i]]);
             normals.push_back(vertex_normals[tri.normal_indices[i]]);
@@ -1,9 +1,12 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
 #include "algebra.h"
+#include "thread_pool.h"
 
 struct Vertex
 {
@@ -24,20 +27,45 @@ struct OwnedTriangle
     Vertex vertices[3];
 };
 
+// How implicit fairing solves its linear system
+enum class FairingSolver
+{
+    // Ldlt for meshes small enough to factorize quickly, ConjugateGradient otherwise
+    Automatic,
+    // Sparse LU factorization of the non-symmetric system (I - h * M^-1 * L) x = x0
+    Lu,
+    // Sparse Cholesky (LDL^T) factorization of the symmetric positive definite
+    // system (M - h * L) x = M * x0, where M is the lumped mass matrix
+    Ldlt,
+    // Conjugate gradients on the same system as Ldlt, starting from the current
+    // positions, which needs no factorization and runs on the thread pool
+    ConjugateGradient
+};
+
+class HalfedgeMesh;
+
+// What implicit fairing keeps between calls: the sparsity pattern and symbolic
+// analysis of its linear system and the latest numeric factorization
+struct FairingCache;
+
 // A geometric mesh represented by a list of vertices and faces which store
 // three indices that refer to the vertices, much like the obj format.
 // It uses 0-indexing.
 class Mesh
 {
   public:
-    Mesh() {}
-
-    Mesh(const std::vector<Vec3>& vertex_positions,
-         const std::vector<Vec3>& vertex_normals,
-         const std::vector<IndexedTriangle>& triangles)
-        : vertex_positions(vertex_positions)
-        , vertex_normals(vertex_normals)
-        , tris(triangles)
+    Mesh()
+        : geometry_version(new_geometry_version())
+    {
+    }
+
+    Mesh(std::vector<Vec3> vertex_positions,
+         std::vector<Vec3> vertex_normals,
+         std::vector<IndexedTriangle> triangles)
+        : vertex_positions(std::move(vertex_positions))
+        , vertex_normals(std::move(vertex_normals))
+        , tris(std::move(triangles))
+        , geometry_version(new_geometry_version())
     {
     }
 
@@ -45,14 +73,41 @@ class Mesh
     const std::vector<Vec3>& get_vertex_normals() const { return vertex_normals; }
     const std::vector<IndexedTriangle>& get_indexed_triangles() const { return tris; }
 
-    void recalculate_normals();
-    void implicit_fairing(float h);
+    // The connectivity of the triangles, for geometry processing such as the
+    // laplacian. It is only built when it is first needed, and is shared with
+    // copies of the mesh as the triangles never change.
+    const HalfedgeMesh& get_halfedges();
+
+    // Replaces the normals by one per position, averaged over the faces around it
+    // and weighted by their area. The work is spread over the pool if one is given.
+    void recalculate_normals(ThreadPool* pool = nullptr);
+
+    // Smooths the mesh by a time step of h. The connectivity and the symbolic
+    // analysis of the system are only computed the first time and are shared with
+    // copies of the mesh, as the triangles never change; the numeric factorization
+    // is reused as long as the positions, h and the solver are the same. The
+    // conjugate gradient solver and the new normals spread their work over the pool
+    // if one is given. Throws, leaving the mesh unchanged, if the system cannot be
+    // factorized or solved.
+    void implicit_fairing(float h,
+                          FairingSolver solver = FairingSolver::Automatic,
+                          ThreadPool* pool = nullptr);
 
     std::vector<OwnedTriangle> owned_triangles() const;
     void create_buffers(std::vector<Vec3>& positions, std::vector<Vec3>& normals) const;
 
   private:
+    static uint64_t new_geometry_version();
+    FairingCache& get_fairing_cache();
+
     std::vector<Vec3> vertex_positions;
     std::vector<Vec3> vertex_normals;
     std::vector<IndexedTriangle> tris;
+
+    // Identifies the current positions, which copies of the mesh share until they
+    // are changed
+    uint64_t geometry_version;
+
+    std::shared_ptr<const HalfedgeMesh> halfedges;
+    std::shared_ptr<FairingCache> fairing_cache;
 };
\ No newline at end of file
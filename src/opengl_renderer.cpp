@@ -81,21 +81,27 @@ static void draw_objects(const Scene& scene)
     Mat4 scene_transform_mat = scene.global_transform().matrix();
     glMultMatrixf((float*)&scene_transform_mat);
 
-    for (auto instance : scene.get_instances()) {
+    const InstanceArray& instances = scene.get_instances();
+    const std::vector<uint32_t>& material_indices = instances.material_indices();
+
+    for (size_t i = 0; i < instances.size(); i++) {
         // Copy the top element again
         glPushMatrix();
 
         // Multiply by the tranform of the object being drawn
-        Mat4 model_mat = instance.transform.matrix();
+        Mat4 model_mat = instances.transforms()[i];
         glMultMatrixf((float*)&model_mat);
 
-        // Set material
-        glMaterialfv(GL_FRONT, GL_AMBIENT, instance.material.ambient().float_ptr());
-        glMaterialfv(GL_FRONT, GL_DIFFUSE, instance.material.diffuse().float_ptr());
-        glMaterialfv(GL_FRONT, GL_SPECULAR, instance.material.specular().float_ptr());
-        glMaterialf(GL_FRONT, GL_SHININESS, instance.material.shininess());
+        // Set material, unless the previous instance already used the same one
+        if (i == 0 || material_indices[i] != material_indices[i - 1]) {
+            const PhongMaterial& material = instances.material(i);
+            glMaterialfv(GL_FRONT, GL_AMBIENT, material.ambient().float_ptr());
+            glMaterialfv(GL_FRONT, GL_DIFFUSE, material.diffuse().float_ptr());
+            glMaterialfv(GL_FRONT, GL_SPECULAR, material.specular().float_ptr());
+            glMaterialf(GL_FRONT, GL_SHININESS, material.shininess());
+        }
 
-        const auto& mesh = scene.get_meshes().at(instance.mesh_index);
+        const auto& mesh = *scene.get_meshes()[instances.mesh_indices()[i]];
 
         // Draw!
         glVertexPointer(3, GL_FLOAT, 0, mesh.get_positions().data());
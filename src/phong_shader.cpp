@@ -1,34 +1,54 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 #include "phong_shader.h"
 
+PhongLights::PhongLights(const Scene& scene, float cutoff)
+    : camera_position(scene.camera().position())
+    , attenuated(false)
+{
+    const auto& point_lights = scene.get_point_lights();
+    for (auto* array : { &x, &y, &z, &r, &g, &b, &attenuation, &radius })
+        array->reserve(point_lights.size());
+
+    for (const auto& light : point_lights) {
+        x.push_back(light.position().x());
+        y.push_back(light.position().y());
+        z.push_back(light.position().z());
+        r.push_back(light.colour().r);
+        g.push_back(light.colour().g);
+        b.push_back(light.colour().b);
+        attenuation.push_back(light.get_attenuation());
+        attenuated |= light.get_attenuation() != 0.0f;
+
+        // Solve c / (1 + a * d^2) = cutoff for d, where c is the brightest channel
+        float brightest = std::max(light.colour().r, std::max(light.colour().g, light.colour().b));
+        if (light.get_attenuation() <= 0.0f)
+            radius.push_back(std::numeric_limits<float>::infinity());
+        else if (brightest <= cutoff)
+            radius.push_back(0.0f);
+        else
+            radius.push_back(std::sqrt((brightest / cutoff - 1.0f) / light.get_attenuation()));
+    }
+}
+
+LightList PhongLights::all() const
+{
+    LightList list(size());
+    for (size_t i = 0; i < size(); i++)
+        list[i] = i;
+    return list;
+}
+
 Colour PhongShader::shade(const SurfacePoint& surface_point,
                           const PhongMaterial& material,
                           const Scene& scene) const
 {
-    Vec3 cam_dir = (scene.camera().position() - surface_point.world_position).normalized();
-
-    Colour diffuse, specular;
-
-    for (auto light : scene.get_point_lights()) {
-
-        Vec3 light_dir = (light.position() - surface_point.world_position);
-        float light_dist = light_dir.norm();
-        light_dir /= light_dist;
-
-        Colour light_col = light.colour() /
-                           (1.0f + light.get_attenuation() * light_dist * light_dist);
-
-        Vec3 unit_normal = surface_point.normal.normalized();
-
-        diffuse += light_col * std::max(0.0f, light_dir.dot(unit_normal));
-
-        specular += light_col *
-                    std::pow(
-                        std::max(0.0f, unit_normal.dot((cam_dir + light_dir).normalized())),
-                        material.shininess());
-    }
-
-    // Note: Colour gets clamped later on
-    return material.ambient() +
-           material.diffuse() * diffuse +
-           material.specular() * specular;
+    // Gathers the lights for every call, so renderers that shade many points
+    // should build PhongLights once and use the other overload
+    PhongLights lights(scene);
+    LightList light_list = lights.all();
+    return lights.attenuated ? shade<true>(surface_point, material, lights, light_list)
+                             : shade<false>(surface_point, material, lights, light_list);
 }
\ No newline at end of file
@@ -1,8 +1,58 @@
 #pragma once
 
+#include <cstdint>
+#include <vector>
+
 #include "colour.h"
+#include "simd_math.h"
 #include "software_shader.h"
 
+// simd_width surface points in structure of arrays layout
+struct SurfacePacket
+{
+    Float8 x, y, z;
+    Float8 normal_x, normal_y, normal_z;
+};
+
+// simd_width colours in structure of arrays layout
+struct ColourPacket
+{
+    Float8 r, g, b;
+};
+
+// Indices of the lights that can reach some region, in increasing order
+using LightList = std::vector<uint32_t>;
+
+// The parts of a scene that Phong shading reads, gathered once per frame so they
+// are not looked up for every shaded point. Lights are stored as a structure of
+// arrays.
+struct PhongLights
+{
+    // Lights whose contribution falls below the cutoff are treated as having no
+    // effect, see radius
+    static constexpr float default_cutoff = 1.0f / 1024.0f;
+
+    explicit PhongLights(const Scene& scene, float cutoff = default_cutoff);
+
+    Vec3 camera_position;
+
+    std::vector<float> x, y, z;
+    std::vector<float> r, g, b;
+    std::vector<float> attenuation;
+
+    // Distance beyond which a light's (attenuated) colour is below the cutoff in
+    // every channel. Infinite for lights without attenuation.
+    std::vector<float> radius;
+
+    // Whether any light has non-zero attenuation
+    bool attenuated;
+
+    size_t size() const { return x.size(); }
+
+    // Every light
+    LightList all() const;
+};
+
 class PhongShader : public SoftwareShader
 {
   public:
@@ -15,8 +65,134 @@ class PhongShader : public SoftwareShader
                  const PhongMaterial& material,
                  const Scene& scene) const override;
 
+    // Shades a point with constants gathered beforehand, using only the listed
+    // lights. Attenuation may only be false if none of the lights are attenuated,
+    // in which case it is skipped.
+    template <bool Attenuation>
+    static Colour shade(const SurfacePoint& surface_point,
+                        const PhongMaterial& material,
+                        const PhongLights& lights,
+                        const LightList& light_list);
+
+    // Shades simd_width points at once. Unlike the other overloads this uses
+    // approx_pow for the specular term, so results differ slightly (see its
+    // error bound). Unused lanes may hold any finite values.
+    template <bool Attenuation>
+    static ColourPacket shade(const SurfacePacket& points,
+                              const PhongMaterial& material,
+                              const PhongLights& lights,
+                              const LightList& light_list);
+
     bool per_pixel_shading() const override { return per_pixel; }
 
   private:
     bool per_pixel;
-};
\ No newline at end of file
+};
+
+template <bool Attenuation>
+Colour PhongShader::shade(const SurfacePoint& surface_point,
+                          const PhongMaterial& material,
+                          const PhongLights& lights,
+                          const LightList& light_list)
+{
+    Vec3 cam_dir = (lights.camera_position - surface_point.world_position).normalized();
+    Vec3 unit_normal = surface_point.normal.normalized();
+
+    Colour diffuse, specular;
+
+    for (uint32_t i : light_list) {
+
+        Vec3 light_dir = Vec3(lights.x[i], lights.y[i], lights.z[i]) - surface_point.world_position;
+        float light_dist = light_dir.norm();
+        light_dir /= light_dist;
+
+        Colour light_col(lights.r[i], lights.g[i], lights.b[i]);
+        if (Attenuation)
+            light_col = light_col / (1.0f + lights.attenuation[i] * light_dist * light_dist);
+
+        diffuse += light_col * std::max(0.0f, light_dir.dot(unit_normal));
+
+        specular += light_col *
+                    std::pow(
+                        std::max(0.0f, unit_normal.dot((cam_dir + light_dir).normalized())),
+                        material.shininess());
+    }
+
+    // Note: Colour gets clamped later on
+    return material.ambient() +
+           material.diffuse() * diffuse +
+           material.specular() * specular;
+}
+
+template <bool Attenuation>
+ColourPacket PhongShader::shade(const SurfacePacket& points,
+                                const PhongMaterial& material,
+                                const PhongLights& lights,
+                                const LightList& light_list)
+{
+    const Float8 zero = Float8::set1(0.0f);
+
+    Float8 cam_x = Float8::set1(lights.camera_position.x()) - points.x;
+    Float8 cam_y = Float8::set1(lights.camera_position.y()) - points.y;
+    Float8 cam_z = Float8::set1(lights.camera_position.z()) - points.z;
+    normalize(cam_x, cam_y, cam_z);
+
+    Float8 normal_x = points.normal_x, normal_y = points.normal_y, normal_z = points.normal_z;
+    normalize(normal_x, normal_y, normal_z);
+
+    // The specular term is by far the most expensive, so skip it when it has no effect
+    const Colour& material_specular = material.specular();
+    bool specular_term = material_specular.r != 0.0f || material_specular.g != 0.0f || material_specular.b != 0.0f;
+    Float8 shininess = Float8::set1(material.shininess());
+
+    ColourPacket diffuse = { zero, zero, zero }, specular = { zero, zero, zero };
+
+    for (uint32_t i : light_list) {
+
+        Float8 light_x = Float8::set1(lights.x[i]) - points.x;
+        Float8 light_y = Float8::set1(lights.y[i]) - points.y;
+        Float8 light_z = Float8::set1(lights.z[i]) - points.z;
+        Float8 light_dist = sqrt(light_x * light_x + light_y * light_y + light_z * light_z);
+        Float8 inv_light_dist = Float8::set1(1.0f) / light_dist;
+        light_x = light_x * inv_light_dist;
+        light_y = light_y * inv_light_dist;
+        light_z = light_z * inv_light_dist;
+
+        Float8 light_r = Float8::set1(lights.r[i]);
+        Float8 light_g = Float8::set1(lights.g[i]);
+        Float8 light_b = Float8::set1(lights.b[i]);
+        if (Attenuation) {
+            Float8 falloff = Float8::set1(1.0f) /
+                             (Float8::set1(1.0f) + Float8::set1(lights.attenuation[i]) * light_dist * light_dist);
+            light_r = light_r * falloff;
+            light_g = light_g * falloff;
+            light_b = light_b * falloff;
+        }
+
+        Float8 lambert = max(zero, light_x * normal_x + light_y * normal_y + light_z * normal_z);
+        diffuse.r = diffuse.r + light_r * lambert;
+        diffuse.g = diffuse.g + light_g * lambert;
+        diffuse.b = diffuse.b + light_b * lambert;
+
+        if (specular_term) {
+            Float8 half_x = cam_x + light_x, half_y = cam_y + light_y, half_z = cam_z + light_z;
+            normalize(half_x, half_y, half_z);
+
+            Float8 highlight = approx_pow(max(zero, normal_x * half_x + normal_y * half_y + normal_z * half_z),
+                                          shininess);
+            specular.r = specular.r + light_r * highlight;
+            specular.g = specular.g + light_g * highlight;
+            specular.b = specular.b + light_b * highlight;
+        }
+    }
+
+    // Note: Colour gets clamped later on
+    const Colour& ambient = material.ambient();
+    const Colour& material_diffuse = material.diffuse();
+    return { Float8::set1(ambient.r) + Float8::set1(material_diffuse.r) * diffuse.r +
+                 Float8::set1(material_specular.r) * specular.r,
+             Float8::set1(ambient.g) + Float8::set1(material_diffuse.g) * diffuse.g +
+                 Float8::set1(material_specular.g) * specular.g,
+             Float8::set1(ambient.b) + Float8::set1(material_diffuse.b) * diffuse.b +
+                 Float8::set1(material_specular.b) * specular.b };
+}
\ No newline at end of file
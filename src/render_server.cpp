@@ -0,0 +1,238 @@
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "batch_renderer.h"
+#include "io/batch_format.h"
+#include "io/ioutil.h"
+#include "io/scene_format.h"
+#include "render_server.h"
+
+// Reads exactly size bytes. Returns false if the connection was closed first.
+static bool read_exactly(int fd, void* data, size_t size)
+{
+    auto* bytes = (unsigned char*)data;
+    while (size > 0) {
+        ssize_t result = ::recv(fd, bytes, size, 0);
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result <= 0)
+            return false;
+        bytes += result;
+        size -= result;
+    }
+    return true;
+}
+
+static bool write_exactly(int fd, const void* data, size_t size)
+{
+    const auto* bytes = (const unsigned char*)data;
+    while (size > 0) {
+        // Without MSG_NOSIGNAL a client that went away would kill the server
+        ssize_t result = ::send(fd, bytes, size, MSG_NOSIGNAL);
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result <= 0)
+            return false;
+        bytes += result;
+        size -= result;
+    }
+    return true;
+}
+
+static bool write_response(int fd, RenderServer::Status status, const void* body, size_t size)
+{
+    uint32_t length = size + 1;
+    unsigned char header[5] = { (unsigned char)length,
+                                (unsigned char)(length >> 8),
+                                (unsigned char)(length >> 16),
+                                (unsigned char)(length >> 24),
+                                status };
+    return write_exactly(fd, header, sizeof(header)) && write_exactly(fd, body, size);
+}
+
+static bool write_response(int fd, RenderServer::Status status, const std::string& message)
+{
+    return write_response(fd, status, message.data(), message.size());
+}
+
+static bool is_shutdown_request(const std::string& request)
+{
+    size_t first = request.find_first_not_of(" \r\n\t");
+    size_t last = request.find_last_not_of(" \r\n\t");
+    return first != std::string::npos && request.compare(first, last + 1 - first, "shutdown") == 0;
+}
+
+RenderServer::RenderServer(const std::string& socket_path, ThreadPool& pool, const RenderServerLimits& limits)
+    : socket_path(socket_path)
+    , pool(pool)
+    , limits(limits)
+    , mesh_cache(limits.mesh_cache_capacity, &pool)
+    , pending(0)
+    , stopping(false)
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path))
+        throw std::runtime_error("Socket path " + socket_path + " is too long");
+    std::strcpy(address.sun_path, socket_path.c_str());
+
+    // Only a socket is replaced, so that a mistyped path cannot remove a file
+    struct stat info;
+    if (::lstat(socket_path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode))
+        ::unlink(socket_path.c_str());
+
+    listen_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0)
+        throw std::runtime_error(std::string("Could not create socket: ") + std::strerror(errno));
+
+    if (::bind(listen_fd, (sockaddr*)&address, sizeof(address)) != 0 || ::listen(listen_fd, 64) != 0) {
+        std::string reason = std::strerror(errno);
+        ::close(listen_fd);
+        throw std::runtime_error("Could not listen on " + socket_path + ": " + reason);
+    }
+}
+
+RenderServer::~RenderServer()
+{
+    stop();
+    join_finished_connections(true);
+    ::close(listen_fd);
+}
+
+void RenderServer::run()
+{
+    while (!stopping) {
+        int fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            // Stopping shuts down the listening socket, which ends up here
+            break;
+        }
+
+        join_finished_connections(false);
+
+        std::lock_guard<std::mutex> lock(connections_mutex);
+        if (stopping || connections.size() >= limits.max_connections) {
+            write_response(fd, Busy, "Too many clients are connected");
+            ::close(fd);
+            continue;
+        }
+
+        auto connection = std::make_unique<Connection>();
+        connection->fd = fd;
+        connection->thread = std::thread(&RenderServer::serve, this, std::ref(*connection));
+        connections.push_back(std::move(connection));
+    }
+
+    stop();
+    join_finished_connections(true);
+    ::unlink(socket_path.c_str());
+}
+
+void RenderServer::stop()
+{
+    if (stopping.exchange(true))
+        return;
+
+    // Wakes up the thread waiting for new clients and the ones waiting for requests
+    ::shutdown(listen_fd, SHUT_RDWR);
+    std::lock_guard<std::mutex> lock(connections_mutex);
+    for (auto& connection : connections)
+        ::shutdown(connection->fd, SHUT_RD);
+}
+
+void RenderServer::join_finished_connections(bool all)
+{
+    std::list<std::unique_ptr<Connection>> finished;
+    {
+        std::lock_guard<std::mutex> lock(connections_mutex);
+        for (auto it = connections.begin(); it != connections.end();) {
+            auto next = std::next(it);
+            if (all || (*it)->finished)
+                finished.splice(finished.end(), connections, it);
+            it = next;
+        }
+    }
+
+    for (auto& connection : finished) {
+        connection->thread.join();
+        ::close(connection->fd);
+    }
+}
+
+void RenderServer::serve(Connection& connection)
+{
+    int fd = connection.fd;
+
+    while (!stopping) {
+        unsigned char header[4];
+        if (!read_exactly(fd, header, sizeof(header)))
+            break;
+        uint32_t length = header[0] | header[1] << 8 | header[2] << 16 | (uint32_t)header[3] << 24;
+
+        // The rest of an oversized request is not read, so the connection cannot
+        // continue after it
+        if (length > limits.max_request_size) {
+            write_response(fd, Failed, "Request is larger than " + std::to_string(limits.max_request_size) + " bytes");
+            break;
+        }
+
+        std::string request(length, '\0');
+        if (!read_exactly(fd, request.data(), length))
+            break;
+
+        if (is_shutdown_request(request)) {
+            write_response(fd, Ok, "");
+            stop();
+            break;
+        }
+
+        if (pending.fetch_add(1) >= limits.max_pending) {
+            pending--;
+            if (!write_response(fd, Busy, "Too many renders are pending"))
+                break;
+            continue;
+        }
+
+        bool written;
+        try {
+            std::vector<unsigned char> image;
+            if (pool.worker_count() == 0)
+                image = render(request);
+            else
+                image = pool.submit([this, &request]() { return render(request); }).get();
+            pending--;
+            written = write_response(fd, Ok, image.data(), image.size());
+        } catch (const std::exception& e) {
+            pending--;
+            written = write_response(fd, Failed, e.what());
+        }
+        if (!written)
+            break;
+    }
+
+    connection.finished = true;
+}
+
+std::vector<unsigned char> RenderServer::render(const std::string& request)
+{
+    BatchJob job = read_batch_job(request, "");
+    if ((size_t)job.width * job.height > limits.max_image_pixels)
+        throw std::runtime_error("Image is larger than " + std::to_string(limits.max_image_pixels) + " pixels");
+
+    Scene scene = read_scene(str_from_file(job.scene_path), directory_of(job.scene_path), mesh_cache);
+    Image image(job.width, job.height);
+    render_job(job, std::move(scene), image, pool);
+
+    if (!job.output_path.empty()) {
+        write_image(image, job.format, job.output_path);
+        return {};
+    }
+    return encode_image(image, job.format);
+}
\ No newline at end of file
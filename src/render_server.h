@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "io/mesh_cache.h"
+#include "thread_pool.h"
+
+// Limits on the work a render server takes on
+struct RenderServerLimits
+{
+    // Renders that may be queued or running at once. Requests beyond this are
+    // turned away as busy.
+    size_t max_pending = 32;
+    // Clients that may be connected at once
+    size_t max_connections = 64;
+    // Largest request accepted, in bytes
+    size_t max_request_size = 1 << 16;
+    // Largest image accepted, in pixels
+    size_t max_image_pixels = 1 << 26;
+    // Meshes kept in memory between requests
+    size_t mesh_cache_capacity = 64;
+};
+
+// Renders scenes on request from clients connected to a Unix domain socket. Meshes
+// are kept between requests, so repeated renders of the same assets skip loading
+// them.
+//
+// Every message in either direction is a frame: its length in bytes as a 32-bit
+// little endian integer, followed by that many bytes. A client may send any number
+// of requests over one connection, each answered in order.
+//
+// A request is the settings of one job in the batch manifest format, without the
+// "job:" line (see io/batch_format.h), or the word "shutdown" to stop the server.
+// Relative paths are relative to the working directory of the server.
+//
+// The first byte of a response is its status, followed by the body:
+//   0  the job was rendered. The body is the encoded image, or empty if the job
+//      has an output path, in which case the image was written there instead.
+//   1  the job failed. The body is the error message.
+//   2  the server is too busy to take the job. The body is a message.
+class RenderServer
+{
+  public:
+    // Binds to the socket path, replacing a socket file left there by a previous
+    // server. Renders are spread over the given pool. Throws if binding fails.
+    RenderServer(const std::string& socket_path, ThreadPool& pool, const RenderServerLimits& limits = {});
+    ~RenderServer();
+
+    RenderServer(RenderServer const&) = delete;
+    void operator=(RenderServer const&) = delete;
+
+    // Serves clients until stopped, then waits for the connected clients' requests
+    // to finish and removes the socket file
+    void run();
+
+    // Makes run return. Safe to call from any thread.
+    void stop();
+
+    enum Status : unsigned char
+    {
+        Ok = 0,
+        Failed = 1,
+        Busy = 2
+    };
+
+  private:
+    struct Connection
+    {
+        int fd;
+        std::thread thread;
+        std::atomic<bool> finished { false };
+    };
+
+    void serve(Connection& connection);
+    std::vector<unsigned char> render(const std::string& request);
+    void join_finished_connections(bool all);
+
+    std::string socket_path;
+    int listen_fd;
+    ThreadPool& pool;
+    RenderServerLimits limits;
+
+    MeshCache mesh_cache;
+    std::atomic<size_t> pending;
+    std::atomic<bool> stopping;
+
+    std::mutex connections_mutex;
+    std::list<std::unique_ptr<Connection>> connections;
+};
\ No newline at end of file
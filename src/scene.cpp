@@ -1,3 +1,5 @@
+#include <cstring>
+
 #include "scene.h"
 
 void MeshBuffers::update_buffers()
@@ -5,4 +7,63 @@ void MeshBuffers::update_buffers()
     positions.clear();
     normals.clear();
     mesh.create_buffers(positions, normals);
+}
+
+void InstanceArray::reserve(size_t count)
+{
+    mesh_idx.reserve(count);
+    transform_mats.reserve(count);
+    material_idx.reserve(count);
+}
+
+size_t InstanceArray::MaterialKeyHash::operator()(const MaterialKey& key) const
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (uint32_t word : key)
+        hash = (hash ^ word) * 0x100000001b3ull;
+    return hash;
+}
+
+InstanceArray::MaterialKey InstanceArray::key_of(const PhongMaterial& material)
+{
+    const float values[10] = {
+        material.ambient().r, material.ambient().g, material.ambient().b,
+        material.diffuse().r, material.diffuse().g, material.diffuse().b,
+        material.specular().r, material.specular().g, material.specular().b,
+        material.shininess()
+    };
+    MaterialKey key;
+    std::memcpy(key.data(), values, sizeof(values));
+    return key;
+}
+
+uint32_t InstanceArray::add_material(const PhongMaterial& material)
+{
+    auto [it, inserted] = palette_indices.emplace(key_of(material), (uint32_t)palette.size());
+    if (inserted)
+        palette.push_back(material);
+    return it->second;
+}
+
+void InstanceArray::add(size_t mesh_index, const Mat4& transform, uint32_t material_index)
+{
+    mesh_idx.push_back((uint32_t)mesh_index);
+    transform_mats.push_back(transform);
+    material_idx.push_back(material_index);
+}
+
+std::vector<RenderPacket> Scene::render_packets() const
+{
+    const std::vector<uint32_t>& mesh_indices = instances->mesh_indices();
+    const std::vector<Mat4>& transforms = instances->transforms();
+
+    std::vector<RenderPacket> packets;
+    packets.reserve(instances->size());
+
+    for (size_t i = 0; i < instances->size(); i++)
+        packets.push_back({ meshes[mesh_indices[i]].get(),
+                            &instances->material(i),
+                            transform.matrix() * transforms[i] });
+
+    return packets;
 }
\ No newline at end of file
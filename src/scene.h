@@ -1,5 +1,9 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
 #include <vector>
 
 #include "camera.h"
@@ -8,84 +12,135 @@
 #include "mesh.h"
 #include "transform.h"
 
-// A 'copy' of an object (by reference through an index) with
-// an associated transformation and material.
-struct Instance
+// The instances of a scene: 'copies' of meshes (by reference through an index),
+// each with a transformation and a material. The properties are kept in separate
+// arrays so that a pass over one of them does not drag the others through the
+// cache, and materials are shared through a palette that holds every distinct
+// material once.
+class InstanceArray
 {
-    Instance(size_t mesh_index,
-             const Transform& transform,
-             const PhongMaterial& material)
-        : mesh_index(mesh_index)
-        , transform(transform)
-        , material(material)
+  public:
+    size_t size() const { return mesh_idx.size(); }
+    bool empty() const { return mesh_idx.empty(); }
+    void reserve(size_t count);
+
+    // Returns the index of the material in the palette, adding it if no instance
+    // uses an identical one yet
+    uint32_t add_material(const PhongMaterial& material);
+
+    void add(size_t mesh_index, const Mat4& transform, uint32_t material_index);
+    void add(size_t mesh_index, const Mat4& transform, const PhongMaterial& material)
     {
+        add(mesh_index, transform, add_material(material));
     }
 
-    size_t mesh_index;
-    Transform transform;
-    PhongMaterial material;
+    const std::vector<uint32_t>& mesh_indices() const { return mesh_idx; }
+    std::vector<Mat4>& transforms() { return transform_mats; }
+    const std::vector<Mat4>& transforms() const { return transform_mats; }
+    const std::vector<uint32_t>& material_indices() const { return material_idx; }
+    const std::vector<PhongMaterial>& materials() const { return palette; }
+
+    const PhongMaterial& material(size_t instance) const { return palette[material_idx[instance]]; }
+
+  private:
+    // A material's bits, so that materials are only merged if they are identical
+    using MaterialKey = std::array<uint32_t, 10>;
+    struct MaterialKeyHash
+    {
+        size_t operator()(const MaterialKey& key) const;
+    };
+    static MaterialKey key_of(const PhongMaterial& material);
+
+    std::vector<uint32_t> mesh_idx;
+    std::vector<Mat4> transform_mats;
+    std::vector<uint32_t> material_idx;
+
+    std::vector<PhongMaterial> palette;
+    std::unordered_map<MaterialKey, uint32_t, MaterialKeyHash> palette_indices;
 };
 
+// A mesh along with the expanded per-corner position and normal buffers used for
+// drawing. It is immutable once created, so it can be shared freely between
+// scenes and threads.
 class MeshBuffers
 {
   public:
-    MeshBuffers(const std::string& identifier, const Mesh& mesh)
+    MeshBuffers(const std::string& identifier, Mesh mesh)
         : identifier(identifier)
-        , mesh(mesh)
+        , mesh(std::move(mesh))
     {
         update_buffers();
     }
 
+    MeshBuffers(MeshBuffers const&) = delete;
+    void operator=(MeshBuffers const&) = delete;
+
     const std::string& get_identifier() const { return identifier; }
     const std::vector<Vec3>& get_positions() const { return positions; }
     const std::vector<Vec3>& get_normals() const { return normals; }
-    Mesh& get_mesh() { return mesh; }
     const Mesh& get_mesh() const { return mesh; }
-    void update_buffers();
 
   private:
+    void update_buffers();
+
     std::string identifier;
     std::vector<Vec3> positions;
     std::vector<Vec3> normals;
     Mesh mesh;
 };
 
+// Everything a renderer needs to draw one instance. Only refers to data owned by
+// the scene, so it is cheap to create and must not outlive the scene.
+struct RenderPacket
+{
+    const MeshBuffers* mesh;
+    const PhongMaterial* material;
+    Mat4 model_to_world;
+};
+
 // A collection of instances of objects along with a camera. Also owns the meshes that
-// the instances refer to.
+// the instances refer to. The instances are shared between copies of a scene and
+// never change, so copying a scene (for example to render it from another camera)
+// costs the same however many instances it has.
 class Scene
 {
   public:
     Scene()
-        : cam(Camera(Mat4::Identity(), Mat4::Identity(), Mat4::Identity()))
+        : instances(std::make_shared<const InstanceArray>())
+        , cam(Camera(Mat4::Identity(), Mat4::Identity(), Mat4::Identity()))
         , transform(Mat4::Identity())
     {
     }
 
-    Scene(const std::vector<MeshBuffers>& meshes,
-          const std::vector<Instance>& instances,
-          const std::vector<PointLight>& point_lights,
+    Scene(std::vector<std::shared_ptr<const MeshBuffers>> meshes,
+          InstanceArray instances,
+          std::vector<PointLight> point_lights,
           const Camera& camera)
-        : meshes(meshes)
-        , instances(instances)
-        , point_lights(point_lights)
+        : meshes(std::move(meshes))
+        , instances(std::make_shared<const InstanceArray>(std::move(instances)))
+        , point_lights(std::move(point_lights))
         , cam(camera)
         , transform(Mat4::Identity())
     {
     }
 
-    std::vector<MeshBuffers>& get_meshes() { return meshes; }
-    const std::vector<MeshBuffers>& get_meshes() const { return meshes; }
-    std::vector<Instance>& get_instances() { return instances; }
-    const std::vector<Instance>& get_instances() const { return instances; }
+    // Meshes are replaced rather than modified in place since they may be shared
+    std::vector<std::shared_ptr<const MeshBuffers>>& get_meshes() { return meshes; }
+    const std::vector<std::shared_ptr<const MeshBuffers>>& get_meshes() const { return meshes; }
+    const InstanceArray& get_instances() const { return *instances; }
     const std::vector<PointLight>& get_point_lights() const { return point_lights; }
     Camera& camera() { return cam; }
     const Camera& camera() const { return cam; }
     Transform& global_transform() { return transform; }
     const Transform& global_transform() const { return transform; }
 
+    // Returns one packet per instance, in instance order, with the global
+    // transform already applied.
+    std::vector<RenderPacket> render_packets() const;
+
   private:
-    std::vector<MeshBuffers> meshes;
-    std::vector<Instance> instances;
+    std::vector<std::shared_ptr<const MeshBuffers>> meshes;
+    std::shared_ptr<const InstanceArray> instances;
 
     std::vector<PointLight> point_lights;
 
@@ -0,0 +1,373 @@
+#pragma once
+
+#include <cstdint>
+
+// Minimal 8-wide SIMD vectors for the software renderer. They map to AVX2 when
+// the compiler targets it, to pairs of SSE2 registers on other x86-64 targets and
+// to plain arrays everywhere else, so the same code compiles on every platform.
+//
+// Comparisons return a bitmask with bit i set when the comparison holds for lane i.
+// Shifts of Int8 are arithmetic.
+
+#if defined(__AVX2__)
+#define SIMD_AVX2 1
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#define SIMD_SSE2 1
+#include <emmintrin.h>
+#else
+#include <cmath>
+#include <cstring>
+#endif
+
+constexpr int simd_width = 8;
+
+struct Int8;
+
+struct Float8
+{
+#if defined(SIMD_AVX2)
+    __m256 v;
+#elif defined(SIMD_SSE2)
+    __m128 lo, hi;
+#else
+    float v[8];
+#endif
+
+    static Float8 set1(float f);
+    // Lanes are base, base + 1, ..., base + 7
+    static Float8 ramp(float base);
+    static Float8 load(const float* p);
+    void store(float* p) const;
+};
+
+struct Int8
+{
+#if defined(SIMD_AVX2)
+    __m256i v;
+#elif defined(SIMD_SSE2)
+    __m128i lo, hi;
+#else
+    int32_t v[8];
+#endif
+
+    static Int8 set1(int32_t i);
+    // Lanes are base, base + step, ..., base + 7 * step
+    static Int8 ramp(int32_t base, int32_t step);
+    void store(int32_t* p) const;
+};
+
+#if defined(SIMD_AVX2)
+
+inline Float8 Float8::set1(float f) { return { _mm256_set1_ps(f) }; }
+inline Float8 Float8::ramp(float base)
+{
+    return { _mm256_add_ps(_mm256_set1_ps(base), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7)) };
+}
+inline Float8 Float8::load(const float* p) { return { _mm256_loadu_ps(p) }; }
+inline void Float8::store(float* p) const { _mm256_storeu_ps(p, v); }
+
+inline Float8 operator+(Float8 a, Float8 b) { return { _mm256_add_ps(a.v, b.v) }; }
+inline Float8 operator-(Float8 a, Float8 b) { return { _mm256_sub_ps(a.v, b.v) }; }
+inline Float8 operator*(Float8 a, Float8 b) { return { _mm256_mul_ps(a.v, b.v) }; }
+inline Float8 operator/(Float8 a, Float8 b) { return { _mm256_div_ps(a.v, b.v) }; }
+inline Float8 min(Float8 a, Float8 b) { return { _mm256_min_ps(a.v, b.v) }; }
+inline Float8 max(Float8 a, Float8 b) { return { _mm256_max_ps(a.v, b.v) }; }
+inline Float8 sqrt(Float8 a) { return { _mm256_sqrt_ps(a.v) }; }
+
+// Bit i is set if a[i] >= b[i]. False for NaN.
+inline int cmp_ge(Float8 a, Float8 b) { return _mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ)); }
+// Bit i is set if a[i] <= b[i]. False for NaN.
+inline int cmp_le(Float8 a, Float8 b) { return _mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ)); }
+
+inline Int8 Int8::set1(int32_t i) { return { _mm256_set1_epi32(i) }; }
+inline Int8 Int8::ramp(int32_t base, int32_t step)
+{
+    return { _mm256_add_epi32(_mm256_set1_epi32(base),
+                              _mm256_mullo_epi32(_mm256_set1_epi32(step),
+                                                 _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7))) };
+}
+
+inline void Int8::store(int32_t* p) const { _mm256_storeu_si256((__m256i*)p, v); }
+
+inline Int8 operator+(Int8 a, Int8 b) { return { _mm256_add_epi32(a.v, b.v) }; }
+inline Int8 operator-(Int8 a, Int8 b) { return { _mm256_sub_epi32(a.v, b.v) }; }
+inline Int8 operator|(Int8 a, Int8 b) { return { _mm256_or_si256(a.v, b.v) }; }
+inline Int8 operator&(Int8 a, Int8 b) { return { _mm256_and_si256(a.v, b.v) }; }
+template <int N>
+inline Int8 shift_left(Int8 a) { return { _mm256_slli_epi32(a.v, N) }; }
+template <int N>
+inline Int8 shift_right(Int8 a) { return { _mm256_srai_epi32(a.v, N) }; }
+
+inline Float8 to_float(Int8 a) { return { _mm256_cvtepi32_ps(a.v) }; }
+// Rounds to the nearest integer, ties to even
+inline Int8 round_to_int(Float8 a) { return { _mm256_cvtps_epi32(a.v) }; }
+// Rounds towards zero
+inline Int8 truncate_to_int(Float8 a) { return { _mm256_cvttps_epi32(a.v) }; }
+inline Int8 bit_cast_int(Float8 a) { return { _mm256_castps_si256(a.v) }; }
+inline Float8 bit_cast_float(Int8 a) { return { _mm256_castsi256_ps(a.v) }; }
+
+// Bit i is set if a[i] < 0
+inline int negative_mask(Int8 a) { return _mm256_movemask_ps(_mm256_castsi256_ps(a.v)); }
+
+#elif defined(SIMD_SSE2)
+
+inline Float8 Float8::set1(float f) { return { _mm_set1_ps(f), _mm_set1_ps(f) }; }
+inline Float8 Float8::ramp(float base)
+{
+    __m128 b = _mm_set1_ps(base);
+    return { _mm_add_ps(b, _mm_setr_ps(0, 1, 2, 3)), _mm_add_ps(b, _mm_setr_ps(4, 5, 6, 7)) };
+}
+inline Float8 Float8::load(const float* p) { return { _mm_loadu_ps(p), _mm_loadu_ps(p + 4) }; }
+inline void Float8::store(float* p) const
+{
+    _mm_storeu_ps(p, lo);
+    _mm_storeu_ps(p + 4, hi);
+}
+
+inline Float8 operator+(Float8 a, Float8 b) { return { _mm_add_ps(a.lo, b.lo), _mm_add_ps(a.hi, b.hi) }; }
+inline Float8 operator-(Float8 a, Float8 b) { return { _mm_sub_ps(a.lo, b.lo), _mm_sub_ps(a.hi, b.hi) }; }
+inline Float8 operator*(Float8 a, Float8 b) { return { _mm_mul_ps(a.lo, b.lo), _mm_mul_ps(a.hi, b.hi) }; }
+inline Float8 operator/(Float8 a, Float8 b) { return { _mm_div_ps(a.lo, b.lo), _mm_div_ps(a.hi, b.hi) }; }
+inline Float8 min(Float8 a, Float8 b) { return { _mm_min_ps(a.lo, b.lo), _mm_min_ps(a.hi, b.hi) }; }
+inline Float8 max(Float8 a, Float8 b) { return { _mm_max_ps(a.lo, b.lo), _mm_max_ps(a.hi, b.hi) }; }
+inline Float8 sqrt(Float8 a) { return { _mm_sqrt_ps(a.lo), _mm_sqrt_ps(a.hi) }; }
+
+inline int cmp_ge(Float8 a, Float8 b)
+{
+    return _mm_movemask_ps(_mm_cmpge_ps(a.lo, b.lo)) | (_mm_movemask_ps(_mm_cmpge_ps(a.hi, b.hi)) << 4);
+}
+inline int cmp_le(Float8 a, Float8 b)
+{
+    return _mm_movemask_ps(_mm_cmple_ps(a.lo, b.lo)) | (_mm_movemask_ps(_mm_cmple_ps(a.hi, b.hi)) << 4);
+}
+
+inline Int8 Int8::set1(int32_t i) { return { _mm_set1_epi32(i), _mm_set1_epi32(i) }; }
+inline Int8 Int8::ramp(int32_t base, int32_t step)
+{
+    return { _mm_setr_epi32(base, base + step, base + 2 * step, base + 3 * step),
+             _mm_setr_epi32(base + 4 * step, base + 5 * step, base + 6 * step, base + 7 * step) };
+}
+
+inline void Int8::store(int32_t* p) const
+{
+    _mm_storeu_si128((__m128i*)p, lo);
+    _mm_storeu_si128((__m128i*)(p + 4), hi);
+}
+
+inline Int8 operator+(Int8 a, Int8 b) { return { _mm_add_epi32(a.lo, b.lo), _mm_add_epi32(a.hi, b.hi) }; }
+inline Int8 operator-(Int8 a, Int8 b) { return { _mm_sub_epi32(a.lo, b.lo), _mm_sub_epi32(a.hi, b.hi) }; }
+inline Int8 operator|(Int8 a, Int8 b) { return { _mm_or_si128(a.lo, b.lo), _mm_or_si128(a.hi, b.hi) }; }
+inline Int8 operator&(Int8 a, Int8 b) { return { _mm_and_si128(a.lo, b.lo), _mm_and_si128(a.hi, b.hi) }; }
+template <int N>
+inline Int8 shift_left(Int8 a) { return { _mm_slli_epi32(a.lo, N), _mm_slli_epi32(a.hi, N) }; }
+template <int N>
+inline Int8 shift_right(Int8 a) { return { _mm_srai_epi32(a.lo, N), _mm_srai_epi32(a.hi, N) }; }
+
+inline Float8 to_float(Int8 a) { return { _mm_cvtepi32_ps(a.lo), _mm_cvtepi32_ps(a.hi) }; }
+inline Int8 round_to_int(Float8 a) { return { _mm_cvtps_epi32(a.lo), _mm_cvtps_epi32(a.hi) }; }
+inline Int8 truncate_to_int(Float8 a) { return { _mm_cvttps_epi32(a.lo), _mm_cvttps_epi32(a.hi) }; }
+inline Int8 bit_cast_int(Float8 a) { return { _mm_castps_si128(a.lo), _mm_castps_si128(a.hi) }; }
+inline Float8 bit_cast_float(Int8 a) { return { _mm_castsi128_ps(a.lo), _mm_castsi128_ps(a.hi) }; }
+
+inline int negative_mask(Int8 a)
+{
+    return _mm_movemask_ps(_mm_castsi128_ps(a.lo)) | (_mm_movemask_ps(_mm_castsi128_ps(a.hi)) << 4);
+}
+
+#else
+
+inline Float8 Float8::set1(float f)
+{
+    Float8 r;
+    for (int i = 0; i < 8; i++)
+        r.v[i] = f;
+    return r;
+}
+inline Float8 Float8::ramp(float base)
+{
+    Float8 r;
+    for (int i = 0; i < 8; i++)
+        r.v[i] = base + (float)i;
+    return r;
+}
+inline Float8 Float8::load(const float* p)
+{
+    Float8 r;
+    for (int i = 0; i < 8; i++)
+        r.v[i] = p[i];
+    return r;
+}
+inline void Float8::store(float* p) const
+{
+    for (int i = 0; i < 8; i++)
+        p[i] = v[i];
+}
+
+#define SIMD_SCALAR_FLOAT_OP(op)                 \
+    inline Float8 operator op(Float8 a, Float8 b) \
+    {                                             \
+        Float8 r;                                 \
+        for (int i = 0; i < 8; i++)               \
+            r.v[i] = a.v[i] op b.v[i];            \
+        return r;                                 \
+    }
+SIMD_SCALAR_FLOAT_OP(+)
+SIMD_SCALAR_FLOAT_OP(-)
+SIMD_SCALAR_FLOAT_OP(*)
+SIMD_SCALAR_FLOAT_OP(/)
+#undef SIMD_SCALAR_FLOAT_OP
+
+inline Float8 min(Float8 a, Float8 b)
+{
+    Float8 r;
+    for (int i = 0; i < 8; i++)
+        r.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i];
+    return r;
+}
+inline Float8 max(Float8 a, Float8 b)
+{
+    Float8 r;
+    for (int i = 0; i < 8; i++)
+        r.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i];
+    return r;
+}
+
+inline Float8 sqrt(Float8 a)
+{
+    Float8 r;
+    for (int i = 0; i < 8; i++)
+        r.v[i] = std::sqrt(a.v[i]);
+    return r;
+}
+
+inline int cmp_ge(Float8 a, Float8 b)
+{
+    int mask = 0;
+    for (int i = 0; i < 8; i++)
+        mask |= (a.v[i] >= b.v[i]) << i;
+    return mask;
+}
+inline int cmp_le(Float8 a, Float8 b)
+{
+    int mask = 0;
+    for (int i = 0; i < 8; i++)
+        mask |= (a.v[i] <= b.v[i]) << i;
+    return mask;
+}
+
+inline Int8 Int8::set1(int32_t i)
+{
+    Int8 r;
+    for (int l = 0; l < 8; l++)
+        r.v[l] = i;
+    return r;
+}
+inline Int8 Int8::ramp(int32_t base, int32_t step)
+{
+    Int8 r;
+    for (int l = 0; l < 8; l++)
+        r.v[l] = base + l * step;
+    return r;
+}
+
+inline void Int8::store(int32_t* p) const
+{
+    for (int i = 0; i < 8; i++)
+        p[i] = v[i];
+}
+
+#define SIMD_SCALAR_INT_OP(op)                \
+    inline Int8 operator op(Int8 a, Int8 b)   \
+    {                                         \
+        Int8 r;                               \
+        for (int i = 0; i < 8; i++)           \
+            r.v[i] = a.v[i] op b.v[i];        \
+        return r;                             \
+    }
+SIMD_SCALAR_INT_OP(+)
+SIMD_SCALAR_INT_OP(-)
+SIMD_SCALAR_INT_OP(|)
+SIMD_SCALAR_INT_OP(&)
+#undef SIMD_SCALAR_INT_OP
+
+template <int N>
+inline Int8 shift_left(Int8 a)
+{
+    Int8 r;
+    for (int i = 0; i < 8; i++)
+        r.v[i] = (int32_t)((uint32_t)a.v[i] << N);
+    return r;
+}
+template <int N>
+inline Int8 shift_right(Int8 a)
+{
+    Int8 r;
+    for (int i = 0; i < 8; i++)
+        r.v[i] = a.v[i] >> N;
+    return r;
+}
+
+inline Float8 to_float(Int8 a)
+{
+    Float8 r;
+    for (int i = 0; i < 8; i++)
+        r.v[i] = (float)a.v[i];
+    return r;
+}
+inline Int8 round_to_int(Float8 a)
+{
+    Int8 r;
+    for (int i = 0; i < 8; i++)
+        r.v[i] = (int32_t)std::nearbyint(a.v[i]);
+    return r;
+}
+inline Int8 truncate_to_int(Float8 a)
+{
+    Int8 r;
+    for (int i = 0; i < 8; i++)
+        r.v[i] = (int32_t)a.v[i];
+    return r;
+}
+inline Int8 bit_cast_int(Float8 a)
+{
+    Int8 r;
+    std::memcpy(r.v, a.v, sizeof(r.v));
+    return r;
+}
+inline Float8 bit_cast_float(Int8 a)
+{
+    Float8 r;
+    std::memcpy(r.v, a.v, sizeof(r.v));
+    return r;
+}
+
+inline int negative_mask(Int8 a)
+{
+    int mask = 0;
+    for (int i = 0; i < 8; i++)
+        mask |= (a.v[i] < 0) << i;
+    return mask;
+}
+
+#endif
+
+// Smallest and largest lane
+inline float horizontal_min(Float8 a)
+{
+    float lanes[8];
+    a.store(lanes);
+    float r = lanes[0];
+    for (int i = 1; i < 8; i++)
+        r = lanes[i] < r ? lanes[i] : r;
+    return r;
+}
+inline float horizontal_max(Float8 a)
+{
+    float lanes[8];
+    a.store(lanes);
+    float r = lanes[0];
+    for (int i = 1; i < 8; i++)
+        r = r < lanes[i] ? lanes[i] : r;
+    return r;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "simd.h"
+
+// Vector math on Float8, including approximations of transcendental functions for
+// shading, where a few ulps of error do not matter but std::pow per lane is too
+// slow.
+
+// Scales the vector (x, y, z) of each lane to unit length. Zero vectors stay zero.
+inline void normalize(Float8& x, Float8& y, Float8& z)
+{
+    Float8 length = sqrt(max(x * x + y * y + z * z, Float8::set1(1e-30f)));
+    Float8 inv_length = Float8::set1(1.0f) / length;
+    x = x * inv_length;
+    y = y * inv_length;
+    z = z * inv_length;
+}
+
+// Base 2 logarithm of positive, normal x. Zero and subnormals give about -127
+// rather than -inf.
+//
+// x is split into 2^e * m with m in [sqrt(1/2), sqrt(2)), and log2(m) is
+// evaluated as the series 2 / ln(2) * atanh(t), t = (m - 1) / (m + 1), up to t^7.
+// Since |t| < 0.172 the truncation error is below 5e-8. Including rounding, the
+// absolute error is within 1.5e-7 + 6e-8 * |log2(x)|.
+inline Float8 approx_log2(Float8 x)
+{
+    // Subtracting the bits of sqrt(1/2) makes the exponent field round to the
+    // nearest power of two instead of truncating
+    Int8 bits = bit_cast_int(x);
+    Int8 e = shift_right<23>(bits - Int8::set1(0x3f3504f3));
+    Float8 m = bit_cast_float(bits - shift_left<23>(e));
+
+    Float8 t = (m - Float8::set1(1.0f)) / (m + Float8::set1(1.0f));
+    Float8 t2 = t * t;
+    Float8 series = Float8::set1(0.41219858f);
+    series = series * t2 + Float8::set1(0.57707802f);
+    series = series * t2 + Float8::set1(0.96179669f);
+    series = series * t2 + Float8::set1(2.88539008f);
+    return to_float(e) + series * t;
+}
+
+// 2 to the power of y. y is clamped to [-126, 127], which keeps the result normal.
+//
+// y is split into n + f with integer n and f in [-1/2, 1/2], and 2^f is evaluated
+// as its Taylor series up to f^6. The truncation error is below 1.2e-7, so the
+// relative error is within 3e-7 including rounding.
+inline Float8 approx_exp2(Float8 y)
+{
+    y = min(max(y, Float8::set1(-126.0f)), Float8::set1(127.0f));
+    Int8 n = round_to_int(y);
+    Float8 f = y - to_float(n);
+
+    Float8 series = Float8::set1(1.5403530e-4f);
+    series = series * f + Float8::set1(1.3333558e-3f);
+    series = series * f + Float8::set1(9.6181291e-3f);
+    series = series * f + Float8::set1(5.5504109e-2f);
+    series = series * f + Float8::set1(2.4022651e-1f);
+    series = series * f + Float8::set1(6.9314718e-1f);
+    series = series * f + Float8::set1(1.0f);
+
+    return series * bit_cast_float(shift_left<23>(n + Int8::set1(127)));
+}
+
+// x to the power of y for non-negative, finite x, as exp2(y * log2(x)). The errors
+// of the logarithm are scaled by y, giving a relative error within
+// 3e-7 + 1.1e-7 * |y| + 9e-8 * |log2(result)| when the result is normal (for
+// example 3e-5 at worst for y = 128). Results below 2^-126 come out as about
+// 2^-126 instead, and 0^0 is 1.
+inline Float8 approx_pow(Float8 x, Float8 y)
+{
+    return approx_exp2(y * approx_log2(x));
+}
\ No newline at end of file
@@ -0,0 +1,49 @@
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(size_t worker_count)
+    : stopping(false)
+{
+    workers.reserve(worker_count);
+    for (size_t i = 0; i < worker_count; i++)
+        workers.emplace_back([this]() { work(); });
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (auto& worker : workers)
+        worker.join();
+}
+
+void ThreadPool::enqueue(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push(std::move(task));
+    }
+    wake.notify_one();
+}
+
+void ThreadPool::work()
+{
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this]() { return stopping || !tasks.empty(); });
+
+            // Remaining tasks are still run when stopping so no future is left hanging
+            if (tasks.empty())
+                return;
+
+            task = std::move(tasks.front());
+            tasks.pop();
+        }
+        task();
+    }
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads that execute queued tasks in the order they
+// were submitted.
+class ThreadPool
+{
+  public:
+    // Starts the given number of worker threads. A pool without workers is valid;
+    // parallel_for then runs everything on the calling thread.
+    explicit ThreadPool(size_t worker_count);
+    ~ThreadPool();
+
+    ThreadPool(ThreadPool const&) = delete;
+    void operator=(ThreadPool const&) = delete;
+
+    size_t worker_count() const { return workers.size(); }
+
+    // Queues a task and returns a future that holds its result (or exception).
+    template <typename F>
+    auto submit(F task) -> std::future<decltype(task())>;
+
+    // Calls body(i) for every i in [0, count) and returns once all calls have
+    // finished. The calling thread takes part in the work, so this may safely be
+    // called from within a task running on the pool. The first exception thrown
+    // by body is rethrown on the calling thread.
+    template <typename F>
+    void parallel_for(size_t count, F body);
+
+  private:
+    void enqueue(std::function<void()> task);
+    void work();
+
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+};
+
+// The number of items in each chunk of parallel_for_chunks. As it does not depend
+// on the number of threads, neither do results that are added up per chunk.
+constexpr size_t parallel_chunk_size = 4096;
+
+inline size_t parallel_chunk_count(size_t count)
+{
+    return (count + parallel_chunk_size - 1) / parallel_chunk_size;
+}
+
+// Calls body(chunk, begin, end) for the consecutive chunks of parallel_chunk_size
+// items that [0, count) is split into, on the pool if one is given and on the
+// calling thread otherwise.
+template <typename F>
+void parallel_for_chunks(ThreadPool* pool, size_t count, F body)
+{
+    auto run_chunk = [&](size_t chunk) {
+        body(chunk, chunk * parallel_chunk_size, std::min(count, (chunk + 1) * parallel_chunk_size));
+    };
+    if (pool) {
+        pool->parallel_for(parallel_chunk_count(count), run_chunk);
+    } else {
+        for (size_t chunk = 0; chunk < parallel_chunk_count(count); chunk++)
+            run_chunk(chunk);
+    }
+}
+
+template <typename F>
+auto ThreadPool::submit(F task) -> std::future<decltype(task())>
+{
+    // std::function needs a copyable target, so the packaged task is shared
+    auto packaged = std::make_shared<std::packaged_task<decltype(task())()>>(std::move(task));
+    auto future = packaged->get_future();
+    enqueue([packaged]() { (*packaged)(); });
+    return future;
+}
+
+template <typename F>
+void ThreadPool::parallel_for(size_t count, F body)
+{
+    if (count == 0)
+        return;
+
+    // Shared between the caller and the helpers. Helpers may start after the loop
+    // has already finished, in which case they find no work and only touch this.
+    struct LoopState
+    {
+        std::atomic<size_t> next { 0 };
+        std::atomic<size_t> finished { 0 };
+        std::mutex mutex;
+        std::condition_variable all_done;
+        std::exception_ptr error;
+    };
+    auto state = std::make_shared<LoopState>();
+    F* body_ptr = &body;
+
+    auto run = [state, body_ptr, count]() {
+        size_t i;
+        while ((i = state->next.fetch_add(1)) < count) {
+            try {
+                (*body_ptr)(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                if (!state->error)
+                    state->error = std::current_exception();
+            }
+            if (state->finished.fetch_add(1) + 1 == count) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->all_done.notify_all();
+            }
+        }
+    };
+
+    size_t helper_count = std::min(workers.size(), count - 1);
+    for (size_t i = 0; i < helper_count; i++)
+        enqueue(run);
+
+    run();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->all_done.wait(lock, [&]() { return state->finished.load() == count; });
+    if (state->error)
+        std::rethrow_exception(state->error);
+}
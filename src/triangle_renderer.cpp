@@ -1,149 +1,1024 @@
 #include <iostream>
+#include <vector>
 
 #include "depth_buffer.h"
+#include "phong_shader.h"
+#include "simd.h"
 #include "triangle_renderer.h"
 
-static bool in_unit_cube(const Vec3& pos)
-{
-    return pos.x() >= -1.0f && pos.x() <= 1.0f &&
-           pos.y() >= -1.0f && pos.y() <= 1.0f &&
-           pos.z() >= -1.0f && pos.z() <= 1.0f;
-}
-
-static bool is_back_face(Vec3 ndc_positions[3])
+static bool is_back_face(const Vec3 ndc_positions[3])
 {
     Vec3 ab = ndc_positions[1] - ndc_positions[0];
     Vec3 ac = ndc_positions[2] - ndc_positions[0];
     return (ab.x() * ac.y() - ac.x() * ab.y()) < 0.0f;
 }
 
-// Corresponding to the function f_ij given in the lecture notes
-static int f_ij(Point2 i, Point2 j, int x, int y)
+// An edge function w(x, y) = a * x + b * y + c over the raster, corresponding to
+// the function f_ij given in the lecture notes. It is oriented so that it is
+// non-negative on the inside of the triangle.
+struct EdgeFunction
+{
+    int a, b, c;
+
+    int at(int x, int y) const { return a * x + b * y + c; }
+};
+
+// An attribute expressed as a linear function over the raster. The coordinates
+// are relative to the triangle's first vertex to keep precision.
+struct PlaneEquation
+{
+    float dx, dy, origin;
+
+    float at(float x, float y) const { return origin + dy * y + dx * x; }
+};
+
+// A triangle that has been transformed to NDC (and shaded, if shading is done per
+// vertex) and is ready to be rasterised.
+struct SetupTriangle
 {
-    return (i.y() - j.y()) * x + (j.x() - i.x()) * y + i.x() * j.y() - j.x() * i.y();
+    EdgeFunction edges[3];
+
+    // Raster position of the first vertex, which the plane equations are relative to
+    int origin_x, origin_y;
+
+    PlaneEquation ndc[3];
+
+    // Used by per-pixel shading
+    PlaneEquation world_position[3];
+    PlaneEquation normal[3];
+
+    // Used by per-vertex shading
+    PlaneEquation colour[3];
+
+    // Raster space bounding box. The maximum is exclusive.
+    int x0, x1, y0, y1;
+
+    const PhongMaterial* material;
+    bool culled;
+
+    // The other triangles that clipping split this one into, as a range of the
+    // clipped parts of the same instance. Parts are set up even when this one is
+    // culled.
+    uint32_t first_part;
+    uint32_t part_count;
+};
+
+static EdgeFunction edge_function(Point2 i, Point2 j)
+{
+    return { i.y() - j.y(), j.x() - i.x(), i.x() * j.y() - j.x() * i.y() };
+}
+
+// Builds the plane equation that interpolates the given per-vertex values. The
+// edge functions of the second and third vertex are their barycentric coordinates
+// scaled by the triangle's (doubled) area.
+static PlaneEquation plane_equation(const EdgeFunction edges[3],
+                                    float inv_area,
+                                    float v0,
+                                    float v1,
+                                    float v2)
+{
+    float d1 = (v1 - v0) * inv_area;
+    float d2 = (v2 - v0) * inv_area;
+    return { edges[1].a * d1 + edges[2].a * d2,
+             edges[1].b * d1 + edges[2].b * d2,
+             v0 };
 }
 
-static SurfacePoint interpolate_surface_point(float alpha, float beta, float gamma, const SurfacePoint p[3])
+// A screen region that is rasterised as one unit. The maximum is exclusive.
+struct Tile
 {
-    return SurfacePoint(alpha * p[0].world_position +
-                            beta * p[1].world_position +
-                            gamma * p[2].world_position,
-                        alpha * p[0].normal +
-                            beta * p[1].normal +
-                            gamma * p[2].normal
+    int x0, x1, y0, y1;
+};
 
-    );
+// Runs body(i) for i in [0, count), in parallel if a pool is given.
+template <typename F>
+static void for_each_index(ThreadPool* pool, size_t count, F body)
+{
+    if (pool) {
+        pool->parallel_for(count, body);
+    } else {
+        for (size_t i = 0; i < count; i++)
+            body(i);
+    }
 }
 
-static Vec3 interpolate_vector(float alpha, float beta, float gamma, const Vec3 vec[3])
+// Bits of a vertex's outcode. The first six are set when the vertex lies outside
+// one side of the view volume, the rest when it lies outside a plane that
+// triangles are clipped against before setup.
+enum Outcode : uint16_t
+{
+    outside_left = 1 << 0,
+    outside_right = 1 << 1,
+    outside_bottom = 1 << 2,
+    outside_top = 1 << 3,
+    outside_near = 1 << 4,
+    outside_far = 1 << 5,
+    view_volume_outcodes = (1 << 6) - 1,
+
+    clip_near = 1 << 6,
+    clip_guard_left = 1 << 7,
+    clip_guard_right = 1 << 8,
+    clip_guard_bottom = 1 << 9,
+    clip_guard_top = 1 << 10,
+};
+
+constexpr int clip_plane_count = 5;
+
+// Triangles are clipped to a guard band that extends this many pixels from the
+// centre of the image (or to the image itself if that is larger). Triangles
+// inside it are rasterised unclipped, which is cheap since only pixels in the
+// image are visited, while raster coordinates stay small enough for the integer
+// edge functions not to overflow.
+constexpr int guard_band_pixels = 8192;
+
+// The extent of the guard band in NDC
+struct GuardBand
+{
+    float x, y;
+
+    GuardBand(const Image& image)
+        : x(std::max(1.0f, 2.0f * guard_band_pixels / image.width()))
+        , y(std::max(1.0f, 2.0f * guard_band_pixels / image.height()))
+    {
+    }
+};
+
+// Signed distances (scaled by w) of a clip space position to the clipping planes,
+// in the order of the clip_ outcodes. They are non-negative on the inside.
+static void clip_distances(const Vec4& clip_pos, const GuardBand& guard_band, float distances[clip_plane_count])
 {
-    return alpha * vec[0] +
-           beta * vec[1] +
-           gamma * vec[2];
+    distances[0] = clip_pos.z() + clip_pos.w();
+    distances[1] = guard_band.x * clip_pos.w() + clip_pos.x();
+    distances[2] = guard_band.x * clip_pos.w() - clip_pos.x();
+    distances[3] = guard_band.y * clip_pos.w() + clip_pos.y();
+    distances[4] = guard_band.y * clip_pos.w() - clip_pos.y();
 }
 
-static Colour interpolate_colour(float alpha, float beta, float gamma, const Colour col[3])
+static uint16_t outcode(const Vec4& clip_pos, const GuardBand& guard_band)
 {
-    return alpha * col[0] +
-           beta * col[1] +
-           gamma * col[2];
+    float x = clip_pos.x(), y = clip_pos.y(), z = clip_pos.z(), w = clip_pos.w();
+    float guard_x = guard_band.x * w, guard_y = guard_band.y * w;
+
+    return (x < -w ? outside_left : 0) |
+           (x > w ? outside_right : 0) |
+           (y < -w ? outside_bottom : 0) |
+           (y > w ? outside_top : 0) |
+           (z < -w ? outside_near | clip_near : 0) |
+           (z > w ? outside_far : 0) |
+           (x < -guard_x ? clip_guard_left : 0) |
+           (x > guard_x ? clip_guard_right : 0) |
+           (y < -guard_y ? clip_guard_bottom : 0) |
+           (y > guard_y ? clip_guard_top : 0);
 }
 
-// Returns whether the barycentric coordinates represent a point inside the triangle.
-static bool is_in_triangle(float alpha, float beta, float gamma)
+// Finds the lights whose radius reaches into the given world space box
+static void cull_lights(const PhongLights& lights, const Vec3& box_min, const Vec3& box_max, LightList& list)
 {
-    return alpha >= 0.0f && alpha <= 1.0f &&
-           beta >= 0.0f && beta <= 1.0f &&
-           gamma >= 0.0f && gamma <= 1.0f;
+    list.clear();
+    for (uint32_t l = 0; l < lights.size(); l++) {
+        float dx = std::max(0.0f, std::max(box_min.x() - lights.x[l], lights.x[l] - box_max.x()));
+        float dy = std::max(0.0f, std::max(box_min.y() - lights.y[l], lights.y[l] - box_max.y()));
+        float dz = std::max(0.0f, std::max(box_min.z() - lights.z[l], lights.z[l] - box_max.z()));
+        if (dx * dx + dy * dy + dz * dz <= lights.radius[l] * lights.radius[l])
+            list.push_back(l);
+    }
 }
 
-static void rasterise_triangle(const Vec3 ndc_positions[3],
-                               const SurfacePoint vertices[3],
-                               const PhongMaterial& material,
-                               const Scene& scene,
-                               SoftwareShader* shader,
-                               Image& image,
-                               DepthBuffer& depth_buffer)
+// Finds a raster rectangle (maximum exclusive, clamped to the image) that contains
+// the projection of a sphere. Returns false if the sphere cannot be seen.
+static bool sphere_raster_bounds(const Vec3& centre,
+                                 float radius,
+                                 const Mat4& world_to_ndc,
+                                 const Image& image,
+                                 int& x0,
+                                 int& x1,
+                                 int& y0,
+                                 int& y1)
 {
-    // Shade triangle before rasterisation if we are doing per vertex shading
-    Colour shaded_vertex_colours[3];
-    if (!shader->per_pixel_shading())
-        for (int i = 0; i < 3; i++)
-            shaded_vertex_colours[i] = shader->shade(vertices[i], material, scene);
+    x0 = 0, x1 = image.width(), y0 = 0, y1 = image.height();
 
-    // Get vertex positions on raster
-    Point2 raster_pos[3] = {
-        ndc_to_raster(ndc_positions[0], image.width(), image.height()),
-        ndc_to_raster(ndc_positions[1], image.width(), image.height()),
-        ndc_to_raster(ndc_positions[2], image.width(), image.height())
+    // The projection of the sphere's bounding box contains the projection of the
+    // sphere. It is the bounding box of the projected corners, unless a corner is
+    // in front of the near plane, in which case it is taken to be the whole image.
+    float min_x = std::numeric_limits<float>::infinity(), max_x = -min_x;
+    float min_y = min_x, max_y = max_x;
+    bool beyond_far = true;
+    for (int corner = 0; corner < 8; corner++) {
+        Vec4 clip_pos = world_to_ndc * Vec4(centre.x() + (corner & 1 ? radius : -radius),
+                                            centre.y() + (corner & 2 ? radius : -radius),
+                                            centre.z() + (corner & 4 ? radius : -radius),
+                                            1.0f);
+        if (clip_pos.z() < -clip_pos.w())
+            return true;
+
+        beyond_far &= clip_pos.z() > clip_pos.w();
+        min_x = std::min(min_x, clip_pos.x() / clip_pos.w());
+        max_x = std::max(max_x, clip_pos.x() / clip_pos.w());
+        min_y = std::min(min_y, clip_pos.y() / clip_pos.w());
+        max_y = std::max(max_y, clip_pos.y() / clip_pos.w());
+    }
+    if (beyond_far)
+        return false;
+
+    // Map to the raster like ndc_to_raster does, with a pixel of margin for
+    // rounding. Clamping first keeps huge extents from overflowing.
+    auto to_raster = [](float ndc, float size) {
+        return std::min(size + 1.0f, std::max(-1.0f, (ndc + 1.0f) / 2.0f * size));
     };
+    float width = (float)image.width(), height = (float)image.height();
+    x0 = std::max(x0, (int)std::floor(to_raster(min_x, width)) - 1);
+    x1 = std::min(x1, (int)std::ceil(to_raster(max_x, width)) + 2);
+    y0 = std::max(y0, (int)std::floor(height - to_raster(max_y, height)) - 1);
+    y1 = std::min(y1, (int)std::ceil(height - to_raster(min_y, height)) + 2);
+    return x0 < x1 && y0 < y1;
+}
+
+// Lists the lights that can reach each screen tile. A light's reach is the
+// projection of the sphere given by its radius.
+static void bin_lights(const PhongLights& lights,
+                       const Mat4& world_to_ndc,
+                       const Image& image,
+                       int tiles_x,
+                       int tiles_y,
+                       std::vector<LightList>& bins)
+{
+    constexpr int tile_size = TriangleRenderer::tile_size;
+    bins.assign((size_t)tiles_x * tiles_y, {});
+
+    for (uint32_t l = 0; l < lights.size(); l++) {
+        int x0 = 0, x1 = image.width(), y0 = 0, y1 = image.height();
+        if (std::isfinite(lights.radius[l]) &&
+            !sphere_raster_bounds(Vec3(lights.x[l], lights.y[l], lights.z[l]),
+                                  lights.radius[l],
+                                  world_to_ndc,
+                                  image,
+                                  x0,
+                                  x1,
+                                  y0,
+                                  y1))
+            continue;
+
+        for (int ty = y0 / tile_size; ty <= (y1 - 1) / tile_size; ty++)
+            for (int tx = x0 / tile_size; tx <= (x1 - 1) / tile_size; tx++)
+                bins[tx + tiles_x * ty].push_back(l);
+    }
+}
+
+// The rasteriser is specialised on a shading policy, which is picked once per
+// render. A policy has per_pixel_shading() and shade(surface_point, material,
+// light_list), which behave like the SoftwareShader functions of the same names
+// but only consider the listed lights. A second shade overload takes a
+// SurfacePacket along with a mask of the lanes that are needed. The renderer
+// builds those lists with the policy, both for the vertices of an instance
+// (cull_lights) and for the tiles (bin_lights).
+
+// Phong shading with the scene constants hoisted out of the per-point call
+template <bool PerPixel, bool Attenuation>
+struct PhongShading
+{
+    const PhongLights& lights;
+
+    static constexpr bool per_pixel_shading() { return PerPixel; }
 
-    int x0 = std::min(raster_pos[0].x(), std::min(raster_pos[1].x(), raster_pos[2].x()));
-    int x1 = std::max(raster_pos[0].x(), std::max(raster_pos[1].x(), raster_pos[2].x()));
-    int y0 = std::min(raster_pos[0].y(), std::min(raster_pos[1].y(), raster_pos[2].y()));
-    int y1 = std::max(raster_pos[0].y(), std::max(raster_pos[1].y(), raster_pos[2].y()));
-
-    for (int i = std::max(0, x0); i < std::min(image.width(), x1); i++) {
-        for (int j = std::max(0, y0); j < std::min(image.height(), y1); j++) {
-
-            // Calculate barycentric coordinates
-            float alpha = (float)f_ij(raster_pos[1], raster_pos[2], i, j) /
-                          f_ij(raster_pos[1], raster_pos[2], raster_pos[0].x(), raster_pos[0].y());
-
-            float beta = (float)f_ij(raster_pos[0], raster_pos[2], i, j) /
-                         f_ij(raster_pos[0], raster_pos[2], raster_pos[1].x(), raster_pos[1].y());
-
-            float gamma = (float)f_ij(raster_pos[0], raster_pos[1], i, j) /
-                          f_ij(raster_pos[0], raster_pos[1], raster_pos[2].x(), raster_pos[2].y());
-
-            if (is_in_triangle(alpha, beta, gamma)) {
-
-                // Calculate pixel NDC coordinate
-                Vec3 interpolated_ndc = interpolate_vector(alpha, beta, gamma, ndc_positions);
-
-                // Cull pixels out of view. Note: backface culling is done earlier.
-                if (depth_buffer.get_unchecked(i, j) >= interpolated_ndc.z() &&
-                    in_unit_cube(interpolated_ndc)) {
-
-                    // Shade triangle while rasterising if we are doing per pixel-shading. If
-                    // we are doing per-vertex shading, interpolate between the vertex colours.
-                    Colour c;
-                    if (shader->per_pixel_shading()) {
-                        c = shader->shade(
-                            SurfacePoint(
-                                interpolate_surface_point(alpha, beta, gamma, vertices)),
-                            material,
-                            scene);
-                    } else {
-                        c = interpolate_colour(alpha, beta, gamma, shaded_vertex_colours);
-                    }
-
-                    // Update the raster and depth buffer
-                    assert(image.is_inside(i, j));
-                    image.get_unchecked(i, j) = c;
-                    depth_buffer.get_unchecked(i, j) = interpolated_ndc.z();
+    Colour shade(const SurfacePoint& surface_point,
+                 const PhongMaterial& material,
+                 const LightList& light_list) const
+    {
+        return PhongShader::shade<Attenuation>(surface_point, material, lights, light_list);
+    }
+
+    ColourPacket shade(const SurfacePacket& points,
+                       int,
+                       const PhongMaterial& material,
+                       const LightList& light_list) const
+    {
+        return PhongShader::shade<Attenuation>(points, material, lights, light_list);
+    }
+
+    void cull_lights(const Vec3& box_min, const Vec3& box_max, LightList& list) const
+    {
+        ::cull_lights(lights, box_min, box_max, list);
+    }
+
+    void bin_lights(const Mat4& world_to_ndc,
+                    const Image& image,
+                    int tiles_x,
+                    int tiles_y,
+                    std::vector<LightList>& bins) const
+    {
+        ::bin_lights(lights, world_to_ndc, image, tiles_x, tiles_y, bins);
+    }
+};
+
+// Calls through the SoftwareShader interface, for shaders without a
+// specialisation. These see every light, so the lists are left empty.
+struct VirtualShading
+{
+    const SoftwareShader* shader;
+    const Scene& scene;
+
+    bool per_pixel_shading() const { return shader->per_pixel_shading(); }
+
+    Colour shade(const SurfacePoint& surface_point, const PhongMaterial& material, const LightList&) const
+    {
+        return shader->shade(surface_point, material, scene);
+    }
+
+    // Shades the given lanes one by one
+    ColourPacket shade(const SurfacePacket& points, int lanes, const PhongMaterial& material, const LightList&) const
+    {
+        float values[6][simd_width];
+        const Float8* inputs[6] = { &points.x, &points.y, &points.z,
+                                    &points.normal_x, &points.normal_y, &points.normal_z };
+        for (int k = 0; k < 6; k++)
+            inputs[k]->store(values[k]);
+
+        float colours[3][simd_width] = {};
+        for (int l = 0; l < simd_width; l++) {
+            if (!(lanes & (1 << l)))
+                continue;
+
+            Colour c = shader->shade(SurfacePoint(Vec3(values[0][l], values[1][l], values[2][l]),
+                                                  Vec3(values[3][l], values[4][l], values[5][l])),
+                                     material,
+                                     scene);
+            colours[0][l] = c.r;
+            colours[1][l] = c.g;
+            colours[2][l] = c.b;
+        }
+        return { Float8::load(colours[0]), Float8::load(colours[1]), Float8::load(colours[2]) };
+    }
+
+    void cull_lights(const Vec3&, const Vec3&, LightList& list) const { list.clear(); }
+
+    void bin_lights(const Mat4&, const Image&, int tiles_x, int tiles_y, std::vector<LightList>& bins) const
+    {
+        bins.assign((size_t)tiles_x * tiles_y, {});
+    }
+};
+
+// Calls render(shading) with the shading policy that matches the shader
+template <typename F>
+static void with_shading(const SoftwareShader* shader, const Scene& scene, F render)
+{
+    const auto* phong = dynamic_cast<const PhongShader*>(shader);
+    if (!phong) {
+        render(VirtualShading { shader, scene });
+        return;
+    }
+
+    PhongLights lights(scene);
+    if (phong->per_pixel_shading()) {
+        if (lights.attenuated)
+            render(PhongShading<true, true> { lights });
+        else
+            render(PhongShading<true, false> { lights });
+    } else {
+        if (lights.attenuated)
+            render(PhongShading<false, true> { lights });
+        else
+            render(PhongShading<false, false> { lights });
+    }
+}
+
+// The vertices of a mesh after transformation for one instance. Vertices shared
+// between triangles are only transformed once.
+struct TransformedVertices
+{
+    std::vector<Vec3> world_positions;
+    std::vector<Vec3> ndc_positions;
+    std::vector<uint16_t> outcodes;
+    std::vector<Vec3> normals;
+
+    // Bounding box of the world positions
+    Vec3 world_min, world_max;
+};
+
+// Transforms every unique position and normal of the mesh
+static void transform_vertices(const Mesh& mesh,
+                               const Mat4& model_to_world,
+                               const Mat4& world_to_ndc,
+                               const Mat3& normal_mat,
+                               const GuardBand& guard_band,
+                               TransformedVertices& vertices)
+{
+    const auto& positions = mesh.get_vertex_positions();
+    vertices.world_positions.resize(positions.size());
+    vertices.ndc_positions.resize(positions.size());
+    vertices.outcodes.resize(positions.size());
+    vertices.world_min = Vec3::Constant(std::numeric_limits<float>::infinity());
+    vertices.world_max = Vec3::Constant(-std::numeric_limits<float>::infinity());
+
+    for (size_t i = 0; i < positions.size(); i++) {
+
+        // Transform position
+        Vec4 vec4_world_pos = Vec4(positions[i].x(),
+                                   positions[i].y(),
+                                   positions[i].z(),
+                                   1.0f);
+
+        vec4_world_pos = model_to_world * vec4_world_pos;
+        vertices.world_positions[i] = Vec3(vec4_world_pos.x(), vec4_world_pos.y(), vec4_world_pos.z());
+        vertices.world_min = vertices.world_min.cwiseMin(vertices.world_positions[i]);
+        vertices.world_max = vertices.world_max.cwiseMax(vertices.world_positions[i]);
+        Vec4 ndc_homog_pos = world_to_ndc * vec4_world_pos;
+        vertices.outcodes[i] = outcode(ndc_homog_pos, guard_band);
+
+        // Only meaningful for vertices in front of the near plane. Triangles with
+        // other vertices are clipped first.
+        vertices.ndc_positions[i] = Vec3(
+            ndc_homog_pos.x() / ndc_homog_pos.w(),
+            ndc_homog_pos.y() / ndc_homog_pos.w(),
+            ndc_homog_pos.z() / ndc_homog_pos.w());
+    }
+
+    // Transform normals
+    const auto& normals = mesh.get_vertex_normals();
+    vertices.normals.resize(normals.size());
+    for (size_t i = 0; i < normals.size(); i++)
+        vertices.normals[i] = normal_mat * normals[i];
+}
+
+// A vertex of a triangle that is being clipped
+struct ClipVertex
+{
+    Vec4 clip_position;
+    Vec3 world_position;
+    Vec3 normal;
+    // Only used by per-vertex shading
+    Colour colour;
+};
+
+// Clips a convex polygon against the planes given by the outcode bits (the
+// Sutherland-Hodgman algorithm). Positions are interpolated linearly in clip
+// space. The other attributes are interpolated linearly on the raster, like the
+// rasteriser does, so that the parts of a clipped triangle show the same colours
+// as the whole triangle would; this is only possible for edges in front of the
+// camera. Returns the new vertex count.
+static int clip_polygon(ClipVertex* polygon, int count, uint16_t planes, const GuardBand& guard_band)
+{
+    ClipVertex clipped[3 + clip_plane_count];
+
+    for (int k = 0; k < clip_plane_count; k++) {
+        if (!(planes & (clip_near << k)))
+            continue;
+
+        float distances[3 + clip_plane_count];
+        for (int i = 0; i < count; i++) {
+            float plane_distances[clip_plane_count];
+            clip_distances(polygon[i].clip_position, guard_band, plane_distances);
+            distances[i] = plane_distances[k];
+        }
+
+        int clipped_count = 0;
+        for (int i = 0; i < count; i++) {
+            int j = (i + 1) % count;
+            const ClipVertex& a = polygon[i];
+            const ClipVertex& b = polygon[j];
+
+            if (distances[i] >= 0.0f)
+                clipped[clipped_count++] = a;
+
+            // Add the intersection if the edge crosses the plane
+            if ((distances[i] >= 0.0f) != (distances[j] >= 0.0f)) {
+                float t = distances[i] / (distances[i] - distances[j]);
+
+                // Where the intersection lies between the two vertices on the raster
+                float w_a = a.clip_position.w(), w_b = b.clip_position.w();
+                float s = w_a > 0.0f && w_b > 0.0f ? t * w_b / ((1.0f - t) * w_a + t * w_b) : t;
+
+                clipped[clipped_count++] = { a.clip_position + t * (b.clip_position - a.clip_position),
+                                             a.world_position + s * (b.world_position - a.world_position),
+                                             a.normal + s * (b.normal - a.normal),
+                                             a.colour + s * (b.colour - a.colour) };
+            }
+        }
+
+        count = clipped_count;
+        std::copy(clipped, clipped + count, polygon);
+        if (count < 3)
+            return 0;
+    }
+
+    return count;
+}
+
+// Does all work for a triangle in front of the near plane and inside the guard
+// band that does not depend on which pixels it covers. With per-vertex shading,
+// the vertices are shaded here unless their colours are given, as they are for
+// the parts of a clipped triangle.
+template <typename Shading>
+static void setup_triangle(const Vec3 ndc_positions[3],
+                           const Vec3 world_positions[3],
+                           const Vec3 normals[3],
+                           const Colour* vertex_colours,
+                           const PhongMaterial& material,
+                           const Shading& shading,
+                           const LightList& lights,
+                           const Image& image,
+                           SetupTriangle& tri)
+{
+    tri.material = &material;
+    tri.part_count = 0;
+    tri.culled = is_back_face(ndc_positions);
+    if (tri.culled)
+        return;
+
+    // Get vertex positions on raster
+    Point2 raster_pos[3];
+    for (int i = 0; i < 3; i++)
+        raster_pos[i] = ndc_to_raster(ndc_positions[i], image.width(), image.height());
+
+    // Set up the edge functions. Each one is zero on the two vertices it is built
+    // from, so evaluating it at the third vertex gives the (signed, doubled) area.
+    tri.edges[0] = edge_function(raster_pos[1], raster_pos[2]);
+    tri.edges[1] = edge_function(raster_pos[0], raster_pos[2]);
+    tri.edges[2] = edge_function(raster_pos[0], raster_pos[1]);
+
+    int area = tri.edges[0].at(raster_pos[0].x(), raster_pos[0].y());
+
+    // Triangles that collapse to a line or a point on the raster cover no pixels
+    if (area == 0) {
+        tri.culled = true;
+        return;
+    }
+
+    // Orient the edges so they are all non-negative inside the triangle. The second
+    // edge runs the opposite way around the triangle compared to the other two.
+    int sign = area > 0 ? 1 : -1;
+    int edge_signs[3] = { sign, -sign, sign };
+    for (int i = 0; i < 3; i++) {
+        tri.edges[i].a *= edge_signs[i];
+        tri.edges[i].b *= edge_signs[i];
+        tri.edges[i].c *= edge_signs[i];
+    }
+
+    // Shift the edge functions of the second and third vertex so that they are zero
+    // at the origin of the plane equations.
+    tri.origin_x = raster_pos[0].x();
+    tri.origin_y = raster_pos[0].y();
+    EdgeFunction relative_edges[3];
+    for (int i = 0; i < 3; i++)
+        relative_edges[i] = { tri.edges[i].a, tri.edges[i].b, 0 };
+
+    float inv_area = 1.0f / std::abs(area);
+
+    for (int i = 0; i < 3; i++)
+        tri.ndc[i] = plane_equation(relative_edges,
+                                    inv_area,
+                                    ndc_positions[0][i],
+                                    ndc_positions[1][i],
+                                    ndc_positions[2][i]);
+
+    if (shading.per_pixel_shading()) {
+        for (int i = 0; i < 3; i++) {
+            tri.world_position[i] = plane_equation(relative_edges,
+                                                   inv_area,
+                                                   world_positions[0][i],
+                                                   world_positions[1][i],
+                                                   world_positions[2][i]);
+            tri.normal[i] = plane_equation(relative_edges,
+                                           inv_area,
+                                           normals[0][i],
+                                           normals[1][i],
+                                           normals[2][i]);
+        }
+    } else {
+        // Shade triangle before rasterisation if we are doing per vertex shading
+        Colour shaded_vertex_colours[3];
+        for (int i = 0; i < 3; i++)
+            shaded_vertex_colours[i] = vertex_colours
+                                           ? vertex_colours[i]
+                                           : shading.shade(SurfacePoint(world_positions[i], normals[i]), material, lights);
+
+        for (int i = 0; i < 3; i++)
+            tri.colour[i] = plane_equation(relative_edges,
+                                           inv_area,
+                                           shaded_vertex_colours[0].float_ptr()[i],
+                                           shaded_vertex_colours[1].float_ptr()[i],
+                                           shaded_vertex_colours[2].float_ptr()[i]);
+    }
+
+    tri.x0 = std::min(raster_pos[0].x(), std::min(raster_pos[1].x(), raster_pos[2].x()));
+    tri.x1 = std::max(raster_pos[0].x(), std::max(raster_pos[1].x(), raster_pos[2].x()));
+    tri.y0 = std::min(raster_pos[0].y(), std::min(raster_pos[1].y(), raster_pos[2].y()));
+    tri.y1 = std::max(raster_pos[0].y(), std::max(raster_pos[1].y(), raster_pos[2].y()));
+}
+
+// Assembles a triangle from transformed vertices and sets it up. Triangles that
+// lie outside the view volume are culled here. Triangles that cross the near
+// plane or leave the guard band are clipped, which may split them into several;
+// the first one is set up in tri and the others are appended to parts.
+template <typename Shading>
+static void assemble_triangle(const IndexedTriangle& indexed_tri,
+                              const TransformedVertices& vertices,
+                              const PhongMaterial& material,
+                              const Shading& shading,
+                              const LightList& lights,
+                              const Image& image,
+                              const Mat4& world_to_ndc,
+                              const GuardBand& guard_band,
+                              SetupTriangle& tri,
+                              std::vector<SetupTriangle>& parts)
+{
+    uint16_t outcodes[3];
+    for (int i = 0; i < 3; i++)
+        outcodes[i] = vertices.outcodes[indexed_tri.position_indices[i]];
+
+    // Reject triangles that are entirely outside one side of the view volume
+    if (outcodes[0] & outcodes[1] & outcodes[2] & view_volume_outcodes) {
+        tri.material = &material;
+        tri.part_count = 0;
+        tri.culled = true;
+        return;
+    }
+
+    Vec3 world_positions[3];
+    Vec3 normals[3];
+    for (int i = 0; i < 3; i++) {
+        world_positions[i] = vertices.world_positions[indexed_tri.position_indices[i]];
+        normals[i] = vertices.normals[indexed_tri.normal_indices[i]];
+    }
+
+    uint16_t clip_planes = (outcodes[0] | outcodes[1] | outcodes[2]) & ~view_volume_outcodes;
+    if (!clip_planes) {
+        Vec3 ndc_positions[3];
+        for (int i = 0; i < 3; i++)
+            ndc_positions[i] = vertices.ndc_positions[indexed_tri.position_indices[i]];
+
+        setup_triangle(ndc_positions, world_positions, normals, nullptr, material, shading, lights, image, tri);
+        return;
+    }
+
+    // Clip space positions are only needed here, so they are not kept per vertex.
+    // With per-vertex shading, only the original vertices are shaded and clipping
+    // interpolates their colours, so that it does not change the colours.
+    bool per_vertex_shading = !shading.per_pixel_shading();
+    ClipVertex polygon[3 + clip_plane_count];
+    for (int i = 0; i < 3; i++) {
+        Vec4 clip_position = world_to_ndc * Vec4(world_positions[i].x(),
+                                                 world_positions[i].y(),
+                                                 world_positions[i].z(),
+                                                 1.0f);
+        Colour colour = per_vertex_shading
+                            ? shading.shade(SurfacePoint(world_positions[i], normals[i]), material, lights)
+                            : Colour();
+        polygon[i] = { clip_position, world_positions[i], normals[i], colour };
+    }
+
+    int count = clip_polygon(polygon, 3, clip_planes, guard_band);
+
+    Vec3 ndc_polygon[3 + clip_plane_count];
+    for (int i = 0; i < count; i++) {
+        const Vec4& p = polygon[i].clip_position;
+        ndc_polygon[i] = Vec3(p.x() / p.w(), p.y() / p.w(), p.z() / p.w());
+    }
+
+    // Split the clipped polygon into a fan of triangles
+    uint32_t first_part = parts.size();
+    for (int i = 1; i + 1 < count; i++) {
+        Vec3 fan_ndc[3] = { ndc_polygon[0], ndc_polygon[i], ndc_polygon[i + 1] };
+        Vec3 fan_world[3] = { polygon[0].world_position, polygon[i].world_position, polygon[i + 1].world_position };
+        Vec3 fan_normals[3] = { polygon[0].normal, polygon[i].normal, polygon[i + 1].normal };
+        Colour fan_colours[3] = { polygon[0].colour, polygon[i].colour, polygon[i + 1].colour };
+        const Colour* colours = per_vertex_shading ? fan_colours : nullptr;
+
+        if (i == 1) {
+            setup_triangle(fan_ndc, fan_world, fan_normals, colours, material, shading, lights, image, tri);
+        } else {
+            parts.emplace_back();
+            setup_triangle(fan_ndc, fan_world, fan_normals, colours, material, shading, lights, image, parts.back());
+        }
+    }
+
+    if (count < 3) {
+        tri.material = &material;
+        tri.culled = true;
+    }
+    tri.part_count = parts.size() - first_part;
+    tri.first_part = first_part;
+}
+
+// Returns the lanes of a span of simd_width pixels whose NDC coordinates lie in
+// the unit cube. Pixels out of view are culled this way.
+static int in_unit_cube(Float8 x, Float8 y, Float8 z)
+{
+    Float8 lo = Float8::set1(-1.0f), hi = Float8::set1(1.0f);
+    return cmp_ge(x, lo) & cmp_le(x, hi) &
+           cmp_ge(y, lo) & cmp_le(y, hi) &
+           cmp_ge(z, lo) & cmp_le(z, hi);
+}
+
+// Returns whether the rectangle (inclusive bounds) lies entirely on the outside
+// of one of the triangle's edges.
+static bool is_outside_triangle(const SetupTriangle& tri, int x0, int x1, int y0, int y1)
+{
+    for (int k = 0; k < 3; k++) {
+        const auto& edge = tri.edges[k];
+
+        // The edge function is linear, so its maximum is at one of the corners
+        int max = edge.at(edge.a > 0 ? x1 : x0, edge.b > 0 ? y1 : y0);
+        if (max < 0)
+            return true;
+    }
+    return false;
+}
+
+// Finds bounds for the depth that the triangle can have at any pixel of the
+// rectangle (inclusive bounds, relative to the triangle's origin). The bounds
+// are padded to cover rounding when the plane equation is evaluated per pixel.
+static void depth_bounds(const PlaneEquation& depth,
+                         float x0,
+                         float x1,
+                         float y0,
+                         float y1,
+                         float& near,
+                         float& far)
+{
+    float x_terms[2] = { depth.dx * x0, depth.dx * x1 };
+    float y_terms[2] = { depth.dy * y0, depth.dy * y1 };
+
+    float max_x_term = std::max(std::abs(x_terms[0]), std::abs(x_terms[1]));
+    float max_y_term = std::max(std::abs(y_terms[0]), std::abs(y_terms[1]));
+    float padding = 1e-6f * (std::abs(depth.origin) + max_x_term + max_y_term);
+
+    near = depth.origin + std::min(y_terms[0], y_terms[1]) + std::min(x_terms[0], x_terms[1]) - padding;
+    far = depth.origin + std::max(y_terms[0], y_terms[1]) + std::max(x_terms[0], x_terms[1]) + padding;
+}
+
+// Colours fragments, which are pixels covered by a triangle. With per-pixel
+// shading the fragments are queued until there are enough to fill a packet, at
+// which point their surface points are reconstructed from the plane equations and
+// shaded together (once for each material among them). The queue is written to
+// the image in order, so a later fragment at the same pixel still wins. With
+// per-vertex shading the vertex colours are interpolated right away.
+template <typename Shading>
+class FragmentQueue
+{
+  public:
+    FragmentQueue(const Shading& shading, const LightList& lights, Image& image)
+        : shading(shading)
+        , lights(lights)
+        , image(image)
+        , count(0)
+    {
+    }
+
+    ~FragmentQueue() { flush(); }
+
+    void push(const SetupTriangle& tri, int i, int j)
+    {
+        assert(image.is_inside(i, j));
+
+        if (!shading.per_pixel_shading()) {
+            float pixel_x = (float)(i - tri.origin_x);
+            float pixel_y = (float)(j - tri.origin_y);
+            image.get_unchecked(i, j) = Colour(tri.colour[0].at(pixel_x, pixel_y),
+                                               tri.colour[1].at(pixel_x, pixel_y),
+                                               tri.colour[2].at(pixel_x, pixel_y));
+            return;
+        }
+
+        tris[count] = &tri;
+        xs[count] = i;
+        ys[count] = j;
+        if (++count == simd_width)
+            flush();
+    }
+
+    // Shades and writes the queued fragments
+    void flush()
+    {
+        if (count == 0)
+            return;
+
+        float values[6][simd_width] = {};
+        for (int l = 0; l < count; l++) {
+            float pixel_x = (float)(xs[l] - tris[l]->origin_x);
+            float pixel_y = (float)(ys[l] - tris[l]->origin_y);
+            for (int k = 0; k < 3; k++) {
+                values[k][l] = tris[l]->world_position[k].at(pixel_x, pixel_y);
+                values[k + 3][l] = tris[l]->normal[k].at(pixel_x, pixel_y);
+            }
+        }
+        SurfacePacket points = { Float8::load(values[0]), Float8::load(values[1]), Float8::load(values[2]),
+                                 Float8::load(values[3]), Float8::load(values[4]), Float8::load(values[5]) };
+
+        float r[simd_width], g[simd_width], b[simd_width];
+        for (int remaining = (1 << count) - 1; remaining;) {
+            const PhongMaterial* material = tris[__builtin_ctz(remaining)]->material;
+            int material_lanes = 0;
+            for (int l = 0; l < count; l++)
+                if ((remaining & (1 << l)) && tris[l]->material == material)
+                    material_lanes |= 1 << l;
+
+            ColourPacket colours = shading.shade(points, material_lanes, *material, lights);
+            float shaded[3][simd_width];
+            colours.r.store(shaded[0]);
+            colours.g.store(shaded[1]);
+            colours.b.store(shaded[2]);
+            for (int l = 0; l < count; l++) {
+                if (material_lanes & (1 << l)) {
+                    r[l] = shaded[0][l];
+                    g[l] = shaded[1][l];
+                    b[l] = shaded[2][l];
                 }
             }
+            remaining &= ~material_lanes;
         }
+
+        for (int l = 0; l < count; l++)
+            image.get_unchecked(xs[l], ys[l]) = Colour(r[l], g[l], b[l]);
+        count = 0;
+    }
+
+  private:
+    const Shading& shading;
+    const LightList& lights;
+    Image& image;
+
+    const SetupTriangle* tris[simd_width];
+    int xs[simd_width], ys[simd_width];
+    int count;
+};
+
+// Rasterises the pixels [x_start, x_end) of row j, at most simd_width of them.
+// The edge functions are evaluated to find the covered pixels and depth of the
+// whole span is tested at once. write_span(x_start, j, lanes) is then called
+// with the mask of the pixels that survive, after which their depths are
+// stored. Returns whether any pixel was written.
+template <typename WriteSpan>
+static bool rasterise_span(const SetupTriangle& tri,
+                           int x_start,
+                           int x_end,
+                           int j,
+                           bool depth_test_passes,
+                           DepthBuffer& depth_buffer,
+                           WriteSpan& write_span)
+{
+    int count = x_end - x_start;
+    int lanes = (1 << count) - 1;
+
+    // A pixel is covered when all three edge functions are non-negative
+    Int8 w[3];
+    for (int k = 0; k < 3; k++)
+        w[k] = Int8::ramp(tri.edges[k].at(x_start, j), tri.edges[k].a);
+
+    int covered = ~negative_mask(w[0] | w[1] | w[2]) & lanes;
+    if (!covered)
+        return false;
+
+    // Calculate pixel NDC coordinates
+    float y = (float)(j - tri.origin_y);
+    Float8 x = Float8::ramp((float)(x_start - tri.origin_x));
+    Float8 ndc[3];
+    for (int k = 0; k < 3; k++)
+        ndc[k] = Float8::set1(tri.ndc[k].origin + tri.ndc[k].dy * y) + Float8::set1(tri.ndc[k].dx) * x;
+
+    // Cull pixels out of view. Note: backface culling is done earlier.
+    float* depth_row = &depth_buffer.get_unchecked(x_start, j);
+    int visible = covered & in_unit_cube(ndc[0], ndc[1], ndc[2]);
+
+    if (!depth_test_passes) {
+        float depths[simd_width];
+        for (int l = 0; l < count; l++)
+            depths[l] = depth_row[l];
+        visible &= cmp_ge(Float8::load(depths), ndc[2]);
     }
+
+    if (!visible)
+        return false;
+
+    write_span(x_start, j, visible);
+
+    float ndc_z[simd_width];
+    ndc[2].store(ndc_z);
+    for (int l = 0; l < count; l++)
+        if (visible & (1 << l))
+            depth_row[l] = ndc_z[l];
+
+    return true;
 }
 
-void TriangleRenderer::render(SoftwareShader* shader, Image& image, const Scene& scene)
+// Rasterises the part of the triangle that lies inside the given tile.
+//
+// The tile is walked in blocks of the depth buffer. Blocks that lie outside one
+// of the edges, or behind everything already drawn in them, are skipped as a
+// whole. The rows of the remaining blocks are rasterised as SIMD spans, see
+// rasterise_span for write_span.
+template <typename WriteSpan>
+static void rasterise_triangle(const SetupTriangle& tri,
+                               const Tile& tile,
+                               DepthBuffer& depth_buffer,
+                               WriteSpan write_span)
 {
-    DepthBuffer depth_buffer(image.width(), image.height());
-    depth_buffer.clear(std::numeric_limits<float>::infinity());
+    static_assert(DepthBuffer::block_size == simd_width, "A block row must fit in one span");
+    constexpr int block_size = DepthBuffer::block_size;
+
+    int x_start = std::max(tile.x0, tri.x0), x_end = std::min(tile.x1, tri.x1);
+    int y_start = std::max(tile.y0, tri.y0), y_end = std::min(tile.y1, tri.y1);
+    if (x_start >= x_end || y_start >= y_end)
+        return;
 
+    for (int block_y = y_start / block_size; block_y <= (y_end - 1) / block_size; block_y++) {
+        int y0 = std::max(y_start, block_y * block_size);
+        int y1 = std::min(y_end, (block_y + 1) * block_size);
+
+        for (int block_x = x_start / block_size; block_x <= (x_end - 1) / block_size; block_x++) {
+            int x0 = std::max(x_start, block_x * block_size);
+            int x1 = std::min(x_end, (block_x + 1) * block_size);
+
+            if (is_outside_triangle(tri, x0, x1 - 1, y0, y1 - 1))
+                continue;
+
+            // Skip the block if the triangle is behind everything drawn there. If it
+            // is in front of everything instead, the per-pixel depth test is not needed.
+            float near, far;
+            depth_bounds(tri.ndc[2],
+                         (float)(x0 - tri.origin_x),
+                         (float)(x1 - 1 - tri.origin_x),
+                         (float)(y0 - tri.origin_y),
+                         (float)(y1 - 1 - tri.origin_y),
+                         near,
+                         far);
+
+            if (near > depth_buffer.block_max(block_x, block_y))
+                continue;
+            bool depth_test_passes = far < depth_buffer.block_min(block_x, block_y);
+
+            bool written = false;
+            for (int j = y0; j < y1; j++)
+                written |= rasterise_span(tri, x0, x1, j, depth_test_passes, depth_buffer, write_span);
+
+            if (written)
+                depth_buffer.update_block(block_x, block_y);
+        }
+    }
+}
+
+// The triangles of a scene after setup, binned into the screen tiles they overlap
+struct BinnedTriangles
+{
+    std::vector<SetupTriangle> triangles;
+
+    int tiles_x, tiles_y;
+
+    // Indices into triangles for every tile, in submission order
+    std::vector<std::vector<uint32_t>> bins;
+
+    // Region of the image covered by a bin
+    Tile tile(size_t bin, const Image& image) const
+    {
+        int tx = bin % tiles_x, ty = bin / tiles_x;
+        return { tx * TriangleRenderer::tile_size,
+                 std::min(image.width(), (tx + 1) * TriangleRenderer::tile_size),
+                 ty * TriangleRenderer::tile_size,
+                 std::min(image.height(), (ty + 1) * TriangleRenderer::tile_size) };
+    }
+};
+
+// Sets up every triangle of the scene and bins it
+template <typename Shading>
+static void setup_and_bin(ThreadPool* pool,
+                          const Shading& shading,
+                          const Image& image,
+                          const Scene& scene,
+                          BinnedTriangles& binned)
+{
     const Mat4 world_to_ndc = scene.camera().world_to_ndc_matrix();
 
-    // First, we get all triangles in the scene. Since vertices are referenced,
-    // we have to dereference them. Then, we tranform the vertices' position along
-    // with normals. Lastly, we start the rasterisation procedure for the triangle.
+    // First, we tranform the vertices' positions along with normals for each
+    // instance. Then, we get all triangles in the scene. Since vertices are
+    // referenced, we have to dereference them. Each instance gets its own range
+    // of the triangle list so instances can be set up in parallel while keeping
+    // the submission order.
 
-    for (auto instance : scene.get_instances()) {
+    // The instance arrays are walked in order rather than through render packets,
+    // which for scenes with many small instances would cost more to build than
+    // the instances take to set up
+    const InstanceArray& instances = scene.get_instances();
+    const std::vector<uint32_t>& mesh_indices = instances.mesh_indices();
+    const auto& meshes = scene.get_meshes();
 
-        auto mesh = scene.get_meshes()[instance.mesh_index];
+    std::vector<size_t> mesh_triangle_counts(meshes.size());
+    for (size_t i = 0; i < meshes.size(); i++)
+        mesh_triangle_counts[i] = meshes[i]->get_mesh().get_indexed_triangles().size();
 
-        Mat4 model_to_world = scene.global_transform().matrix() * instance.transform.matrix();
+    std::vector<size_t> first_triangle(instances.size() + 1, 0);
+    for (size_t i = 0; i < instances.size(); i++)
+        first_triangle[i + 1] = first_triangle[i] + mesh_triangle_counts[mesh_indices[i]];
+
+    auto& triangles = binned.triangles;
+    triangles.resize(first_triangle.back());
+
+    // Triangles that clipping adds are collected per instance and appended after
+    // all others once setup is done
+    std::vector<std::vector<SetupTriangle>> clipped_parts(instances.size());
+    const GuardBand guard_band(image);
+
+    for_each_index(pool, instances.size(), [&](size_t instance_index) {
+        const auto& mesh = meshes[mesh_indices[instance_index]]->get_mesh();
+        const Mat4 model_to_world = scene.global_transform().matrix() * instances.transforms()[instance_index];
 
         // Calculate matrix that properly transforms normals
         Mat3 normal_mat;
@@ -152,51 +1027,170 @@ void TriangleRenderer::render(SoftwareShader* shader, Image& image, const Scene&
             model_to_world(2, 0), model_to_world(2, 1), model_to_world(2, 2);
         normal_mat = normal_mat.inverse().transpose();
 
-        for (int tri = 0; tri < mesh.get_positions().size(); tri += 3) {
+        // Scratch space that is reused by all instances set up on this thread
+        static thread_local TransformedVertices vertices;
+        transform_vertices(mesh, model_to_world, world_to_ndc, normal_mat, guard_band, vertices);
+
+        // Lights that can reach the instance, for shading its vertices
+        static thread_local LightList lights;
+        shading.cull_lights(vertices.world_min, vertices.world_max, lights);
 
-            Vec3 ndc_positions[3];
-            Vec3 world_positions[3];
-            Vec3 normals[3];
+        const auto& indexed_tris = mesh.get_indexed_triangles();
+        for (size_t tri = 0; tri < indexed_tris.size(); tri++) {
+            assemble_triangle(indexed_tris[tri],
+                              vertices,
+                              instances.material(instance_index),
+                              shading,
+                              lights,
+                              image,
+                              world_to_ndc,
+                              guard_band,
+                              triangles[first_triangle[instance_index] + tri],
+                              clipped_parts[instance_index]);
+        }
+    });
+
+    std::vector<size_t> first_part(instances.size());
+    for (size_t i = 0; i < instances.size(); i++) {
+        first_part[i] = triangles.size();
+        triangles.insert(triangles.end(), clipped_parts[i].begin(), clipped_parts[i].end());
+    }
 
-            for (int i = 0; i < 3; i++) {
+    // Bin the triangles into the tiles they overlap, in submission order so that
+    // depth ties resolve the same way as when drawing triangles one by one.
 
-                // Transform position
-                world_positions[i] = mesh.get_positions()[tri + i];
-                Vec4 vec4_world_pos = Vec4(world_positions[i].x(),
-                                           world_positions[i].y(),
-                                           world_positions[i].z(),
-                                           1.0f);
+    constexpr int tile_size = TriangleRenderer::tile_size;
+    binned.tiles_x = (image.width() + tile_size - 1) / tile_size;
+    binned.tiles_y = (image.height() + tile_size - 1) / tile_size;
+    binned.bins.assign((size_t)binned.tiles_x * binned.tiles_y, {});
 
-                vec4_world_pos = model_to_world * vec4_world_pos;
-                world_positions[i] = Vec3(vec4_world_pos.x(), vec4_world_pos.y(), vec4_world_pos.z());
-                Vec4 ndc_homog_pos = world_to_ndc * vec4_world_pos;
+    auto bin_triangle = [&](uint32_t t) {
+        const auto& tri = triangles[t];
+        if (tri.culled)
+            return;
 
-                ndc_positions[i] = Vec3(
-                    ndc_homog_pos.x() / ndc_homog_pos.w(),
-                    ndc_homog_pos.y() / ndc_homog_pos.w(),
-                    ndc_homog_pos.z() / ndc_homog_pos.w());
+        int x0 = std::max(0, tri.x0), x1 = std::min(image.width(), tri.x1);
+        int y0 = std::max(0, tri.y0), y1 = std::min(image.height(), tri.y1);
+        if (x0 >= x1 || y0 >= y1)
+            return;
 
-                // Transform normal
-                normals[i] = normal_mat * mesh.get_normals()[tri + i];
-            }
+        for (int ty = y0 / tile_size; ty <= (y1 - 1) / tile_size; ty++)
+            for (int tx = x0 / tile_size; tx <= (x1 - 1) / tile_size; tx++)
+                binned.bins[tx + binned.tiles_x * ty].push_back(t);
+    };
+
+    // The parts of a clipped triangle are binned right after it
+    for (size_t i = 0; i < instances.size(); i++) {
+        for (size_t t = first_triangle[i]; t < first_triangle[i + 1]; t++) {
+            bin_triangle(t);
+            for (uint32_t k = 0; k < triangles[t].part_count; k++)
+                bin_triangle(first_part[i] + triangles[t].first_part + k);
+        }
+    }
 
-            // Rasterise the triangle
-            if (!is_back_face(ndc_positions)) {
-
-                SurfacePoint surface_points[3] = {
-                    SurfacePoint(world_positions[0], normals[0]),
-                    SurfacePoint(world_positions[1], normals[1]),
-                    SurfacePoint(world_positions[2], normals[2])
-                };
-
-                rasterise_triangle(ndc_positions,
-                                   surface_points,
-                                   instance.material,
-                                   scene,
-                                   shader,
-                                   image,
-                                   depth_buffer);
+    static_assert(TriangleRenderer::tile_size % DepthBuffer::block_size == 0,
+                  "Tiles must be made of whole blocks");
+}
+
+// Rasterises the binned triangles, shading every fragment that passes the depth test
+template <typename Shading>
+static void render_forward(ThreadPool* pool, const Shading& shading, Image& image, const Scene& scene)
+{
+    DepthBuffer depth_buffer(image.width(), image.height());
+    depth_buffer.clear(std::numeric_limits<float>::infinity());
+
+    BinnedTriangles binned;
+    setup_and_bin(pool, shading, image, scene, binned);
+
+    std::vector<LightList> tile_lights;
+    shading.bin_lights(scene.camera().world_to_ndc_matrix(), image, binned.tiles_x, binned.tiles_y, tile_lights);
+
+    // No two tiles touch the same pixels or depth buffer blocks
+    for_each_index(pool, binned.bins.size(), [&](size_t bin) {
+        Tile tile = binned.tile(bin, image);
+
+        FragmentQueue<Shading> fragments(shading, tile_lights[bin], image);
+        for (uint32_t t : binned.bins[bin]) {
+            const auto& tri = binned.triangles[t];
+            rasterise_triangle(tri, tile, depth_buffer, [&](int x_start, int j, int lanes) {
+                for (int l = 0; l < simd_width; l++)
+                    if (lanes & (1 << l))
+                        fragments.push(tri, x_start + l, j);
+            });
+        }
+    });
+}
+
+// Rasterises the binned triangles into a visibility buffer and then shades every
+// visible pixel once
+template <typename Shading>
+static void render_visibility(ThreadPool* pool, const Shading& shading, Image& image, const Scene& scene)
+{
+    DepthBuffer depth_buffer(image.width(), image.height());
+    depth_buffer.clear(std::numeric_limits<float>::infinity());
+
+    BinnedTriangles binned;
+    setup_and_bin(pool, shading, image, scene, binned);
+
+    std::vector<LightList> tile_lights;
+    shading.bin_lights(scene.camera().world_to_ndc_matrix(), image, binned.tiles_x, binned.tiles_y, tile_lights);
+
+    // The visibility buffer holds the index of the visible triangle of every pixel.
+    // Triangles are numbered across all instances, so the index also identifies
+    // the instance and its material.
+    constexpr uint32_t no_triangle = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> visibility((size_t)image.width() * image.height(), no_triangle);
+
+    for_each_index(pool, binned.bins.size(), [&](size_t bin) {
+        Tile tile = binned.tile(bin, image);
+
+        // Resolve visibility without shading anything
+        for (uint32_t t : binned.bins[bin]) {
+            rasterise_triangle(binned.triangles[t], tile, depth_buffer, [&](int x_start, int j, int lanes) {
+                for (int l = 0; l < simd_width; l++)
+                    if (lanes & (1 << l))
+                        visibility[x_start + l + (size_t)image.width() * j] = t;
+            });
+        }
+
+        // Shade each visible pixel of the tile once
+        FragmentQueue<Shading> fragments(shading, tile_lights[bin], image);
+        for (int j = tile.y0; j < tile.y1; j++) {
+            for (int i = tile.x0; i < tile.x1; i++) {
+                uint32_t t = visibility[i + (size_t)image.width() * j];
+                if (t != no_triangle)
+                    fragments.push(binned.triangles[t], i, j);
             }
         }
+    });
+}
+
+TriangleRenderer::TriangleRenderer()
+    : pool(nullptr)
+{
+}
+
+TriangleRenderer::TriangleRenderer(ThreadPool& pool)
+    : pool(&pool)
+{
+}
+
+void TriangleRenderer::render(SoftwareShader* shader, Image& image, const Scene& scene)
+{
+    with_shading(shader, scene, [&](const auto& shading) {
+        render_forward(pool, shading, image, scene);
+    });
+}
+
+void TriangleRenderer::render_deferred(SoftwareShader* shader, Image& image, const Scene& scene)
+{
+    // Per-vertex shading is already done once per vertex, so there is nothing to defer
+    if (!shader->per_pixel_shading()) {
+        render(shader, image, scene);
+        return;
     }
+
+    with_shading(shader, scene, [&](const auto& shading) {
+        render_visibility(pool, shading, image, scene);
+    });
 }
\ No newline at end of file
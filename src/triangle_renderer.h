@@ -5,11 +5,35 @@
 #include "image.h"
 #include "scene.h"
 #include "software_shader.h"
+#include "thread_pool.h"
 
 // A class that handles rasterisation of triangles.
+//
+// Rendering is sort-middle: all triangles are first transformed and binned into
+// screen tiles, after which the tiles are rasterised independently. Every tile
+// owns its own region of the image and depth buffer, so tiles can be processed
+// in parallel without locking while giving the same result as a serial render.
 class TriangleRenderer
 {
   public:
+    // Renders on the calling thread only
+    TriangleRenderer();
+
+    // Spreads the work over the given pool (and the calling thread)
+    TriangleRenderer(ThreadPool& pool);
+
     // Renders a scene according to the given shading algorithm (for example Gouraud or Phong)
     void render(SoftwareShader* shader, Image& image, const Scene& scene);
-};
\ No newline at end of file
+
+    // Renders a scene like render, but with a visibility buffer: the tiles are
+    // first rasterised without shading to find the triangle visible at every
+    // pixel, which is then shaded once. The cost of per-pixel shading therefore
+    // does not grow with overdraw. Gives the same image as render.
+    void render_deferred(SoftwareShader* shader, Image& image, const Scene& scene);
+
+    // Side length of the square screen tiles in pixels
+    static constexpr int tile_size = 64;
+
+  private:
+    ThreadPool* pool;
+};
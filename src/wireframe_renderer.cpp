@@ -115,12 +115,12 @@ void WireframeRenderer::render(Image& image, const Scene& scene)
 {
     const Mat4 world_to_ndc = scene.camera().world_to_ndc_matrix();
 
-    for (auto instance : scene.get_instances()) {
+    for (const auto& packet : scene.render_packets()) {
 
-        auto mesh = scene.get_meshes()[instance.mesh_index];
-        const auto& model_to_world = scene.global_transform().matrix() * instance.transform.matrix();
+        const auto& positions = packet.mesh->get_positions();
+        const Mat4 model_to_ndc = world_to_ndc * packet.model_to_world;
 
-        for (int tri = 0; tri < mesh.get_positions().size(); tri += 3) {
+        for (size_t tri = 0; tri < positions.size(); tri += 3) {
 
             // For each triangle in every instance, we transform its vertices to world
             // coordinates and then convert them to cartesian NDC coordinate, where we
@@ -133,10 +133,10 @@ void WireframeRenderer::render(Image& image, const Scene& scene)
             for (int i = 0; i < 3; i++) {
 
                 Vec3& pos = ndc_positions[i];
-                pos = mesh.get_positions()[tri + i];
+                pos = positions[tri + i];
 
                 Vec4 vec4_pos = Vec4(pos.x(), pos.y(), pos.z(), 1.0f);
-                Vec4 ndc_pos = world_to_ndc * model_to_world * vec4_pos;
+                Vec4 ndc_pos = model_to_ndc * vec4_pos;
 
                 pos = Vec3(
                     ndc_pos.x() / ndc_pos.w(),